@@ -0,0 +1,111 @@
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Results are printed as a table, or as one JSON object per line when
+ * BENCH_JSON is set. When BENCH_BASELINE names a file of JSON lines from an
+ * earlier run, each row also shows its change against the matching row of
+ * that file. A positive change is always an improvement.
+ */
+
+#define BENCH_BASELINE_MAX 512
+
+typedef struct BenchBaseline {
+  char name[64];
+  char param[32];
+  double value;
+} BenchBaseline;
+
+static BenchBaseline bench_baseline[BENCH_BASELINE_MAX];
+static int bench_baseline_count = -1; // Not loaded yet
+
+// Monotonic clock in nanoseconds
+static inline uint64_t bench_now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void __bench_load_baseline() {
+  const char* path = getenv("BENCH_BASELINE");
+  char line[256];
+  FILE* f;
+
+  bench_baseline_count = 0;
+
+  if (path == NULL || (f = fopen(path, "r")) == NULL)
+    return;
+
+  while (bench_baseline_count < BENCH_BASELINE_MAX && fgets(line, sizeof(line), f) != NULL) {
+    BenchBaseline* b = &bench_baseline[bench_baseline_count];
+
+    if (sscanf(line, "{\"name\":\"%63[^\"]\",\"param\":\"%31[^\"]\",\"value\":%lf",
+               b->name, b->param, &b->value) == 3)
+      ++bench_baseline_count;
+  }
+
+  fclose(f);
+}
+
+// Baseline value of a row, or a negative number if there is none
+static inline double __bench_baseline_value(const char* name, const char* param) {
+  if (bench_baseline_count < 0)
+    __bench_load_baseline();
+
+  for (int i = 0; i < bench_baseline_count; ++i) {
+    if (strcmp(bench_baseline[i].name, name) == 0 &&
+        strcmp(bench_baseline[i].param, param) == 0)
+      return bench_baseline[i].value;
+  }
+
+  return -1;
+}
+
+// Prints one result row. unit is "ns/op" or "KB" where lower is better, or
+// "MB/s" where higher is better. count is the ops or megabytes measured.
+static inline void bench_emit(const char* name, const char* param, double value,
+                              const char* unit, uint64_t count) {
+  bool higher_is_better = strcmp(unit, "MB/s") == 0;
+  double base = __bench_baseline_value(name, param);
+
+  if (getenv("BENCH_JSON") != NULL) {
+    printf("{\"name\":\"%s\",\"param\":\"%s\",\"value\":%.3f,\"unit\":\"%s\",\"count\":%llu}\n",
+           name, param, value, unit, (unsigned long long) count);
+  }
+  else {
+    printf("%-28s %-16s %12.1f %-5s %10llu", name, param, value, unit,
+           (unsigned long long) count);
+
+    if (base > 0 && value > 0)
+      printf("  %+7.1f%% vs baseline",
+             100.0 * (higher_is_better ? value / base - 1 : base / value - 1));
+
+    putchar('\n');
+  }
+
+  fflush(stdout);
+}
+
+// Prints the cost per op of a benchmark
+static inline void bench_report(const char* name, const char* param,
+                                uint64_t total_ns, uint64_t ops) {
+  bench_emit(name, param, (double) total_ns / (ops ? ops : 1), "ns/op", ops);
+}
+
+// Prints the data rate of a benchmark that moved the given number of bytes
+static inline void bench_report_rate(const char* name, const char* param,
+                                     uint64_t total_ns, uint64_t bytes) {
+  bench_emit(name, param,
+             (double) bytes / (1 << 20) / ((double) (total_ns ? total_ns : 1) / 1e9),
+             "MB/s", bytes >> 20);
+}
+
+#endif
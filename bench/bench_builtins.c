@@ -0,0 +1,95 @@
+/* bench_builtins.c
+ *
+ * Throughput of a builtin heavy script fed to quash on stdin, once with the
+ * builtins forked into children (QUASH_FORK_BUILTINS=1, the old behaviour)
+ * and once with them run inside quash.
+ *
+ * Usage: bench_builtins [quash binary] [lines]
+ */
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+extern char** environ;
+
+static const char* script_lines[] = {
+  "echo hello world > /dev/null\n",
+  "pwd > /dev/null\n",
+  "echo $HOME $PATH >> /dev/null\n",
+  "jobs > /dev/null\n",
+};
+
+static void __write_script(const char* path, int lines) {
+  FILE* f = fopen(path, "w");
+
+  if (f == NULL) {
+    perror("fopen");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < lines; ++i)
+    fputs(script_lines[i % (sizeof(script_lines) / sizeof(*script_lines))], f);
+
+  fputs("exit\n", f);
+  fclose(f);
+}
+
+static uint64_t __run_quash(const char* quash, const char* script, bool fork_builtins) {
+  posix_spawn_file_actions_t actions;
+  char* argv[] = { (char*) quash, NULL };
+  pid_t pid;
+
+  if (fork_builtins)
+    setenv("QUASH_FORK_BUILTINS", "1", 1);
+  else
+    unsetenv("QUASH_FORK_BUILTINS");
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, script, O_RDONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+  uint64_t start = bench_now_ns();
+
+  if (posix_spawn(&pid, quash, &actions, NULL, argv, environ) != 0) {
+    perror("posix_spawn");
+    exit(EXIT_FAILURE);
+  }
+
+  waitpid(pid, NULL, 0);
+
+  uint64_t elapsed = bench_now_ns() - start;
+
+  posix_spawn_file_actions_destroy(&actions);
+
+  return elapsed;
+}
+
+int main(int argc, char** argv) {
+  const char* quash = argc > 1 ? argv[1] : "./quash";
+  int lines = argc > 2 ? atoi(argv[2]) : 2000;
+  char script[] = "/tmp/quash_bench_builtins_XXXXXX";
+  int fd = mkstemp(script);
+
+  if (fd < 0) {
+    perror("mkstemp");
+    return EXIT_FAILURE;
+  }
+
+  close(fd);
+  __write_script(script, lines);
+
+  bench_report("builtins/forked", "script", __run_quash(quash, script, true), lines);
+  bench_report("builtins/in_process", "script", __run_quash(quash, script, false), lines);
+
+  unlink(script);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,123 @@
+/* bench_deque.c
+ *
+ * Microbenchmarks for the IMPLEMENT_DEQUE family: single element pushes and
+ * pops at both ends, bulk appends, indexed scans and as_array, for both the
+ * malloc backed and the memory pool backed deques.
+ *
+ * Usage: bench_deque [elements]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "deque.h"
+#include "memory_pool.h"
+
+IMPLEMENT_DEQUE_STRUCT(CharDeque, char);
+IMPLEMENT_DEQUE(CharDeque, char);
+IMPLEMENT_DEQUE_STRUCT(PtrDeque, char*);
+IMPLEMENT_DEQUE(PtrDeque, char*);
+IMPLEMENT_DEQUE_STRUCT(MPCharDeque, char);
+IMPLEMENT_DEQUE_MEMORY_POOL(MPCharDeque, char);
+
+static volatile size_t sink; // Keeps results observable to the compiler
+
+static void __bench_char(size_t n) {
+  char chunk[64];
+  uint64_t start;
+
+  for (size_t i = 0; i < sizeof(chunk); ++i)
+    chunk[i] = 'a' + i % 26;
+
+  CharDeque d = new_CharDeque(1);
+  start = bench_now_ns();
+  for (size_t i = 0; i < n; ++i)
+    push_back_CharDeque(&d, (char) i);
+  bench_report("deque/char/push_back", "grow", bench_now_ns() - start, n);
+
+  start = bench_now_ns();
+  size_t sum = 0;
+  for (size_t i = 0; i < n; ++i)
+    sum += peek_at_CharDeque(&d, i);
+  bench_report("deque/char/peek_at", "scan", bench_now_ns() - start, n);
+
+  start = bench_now_ns();
+  for (char* it = iter_first_CharDeque(&d); it != NULL; it = iter_next_CharDeque(&d, it))
+    sum += *it;
+  bench_report("deque/char/iter", "scan", bench_now_ns() - start, n);
+
+  start = bench_now_ns();
+  for (size_t i = 0; i < n; ++i)
+    sum += pop_front_CharDeque(&d);
+  bench_report("deque/char/pop_front", "drain", bench_now_ns() - start, n);
+  destroy_CharDeque(&d);
+
+  d = new_CharDeque(1);
+  start = bench_now_ns();
+  for (size_t i = 0; i < n; i += sizeof(chunk))
+    append_array_CharDeque(&d, chunk, sizeof(chunk));
+  bench_report("deque/char/append_array", "64B", bench_now_ns() - start, n);
+
+  start = bench_now_ns();
+  char* arr = as_array_CharDeque(&d, NULL);
+  bench_report("deque/char/as_array", "aligned", bench_now_ns() - start, 1);
+  free(arr);
+
+  // Wrap the contents around the end of the buffer before converting
+  d = new_CharDeque(n);
+  for (size_t i = 0; i < n / 2; ++i)
+    push_back_CharDeque(&d, (char) i);
+  for (size_t i = 0; i < n / 2; ++i)
+    push_front_CharDeque(&d, (char) i);
+  start = bench_now_ns();
+  arr = as_array_CharDeque(&d, NULL);
+  bench_report("deque/char/as_array", "wrapped", bench_now_ns() - start, 1);
+  free(arr);
+
+  sink = sum;
+}
+
+static void __bench_ptr(size_t n) {
+  PtrDeque d = new_PtrDeque(1);
+  uint64_t start = bench_now_ns();
+
+  for (size_t i = 0; i < n; ++i)
+    push_front_PtrDeque(&d, (char*) i);
+  bench_report("deque/ptr/push_front", "grow", bench_now_ns() - start, n);
+
+  // Steady state queue: one push and one pop per operation
+  start = bench_now_ns();
+  for (size_t i = 0; i < n; ++i)
+    push_back_PtrDeque(&d, pop_front_PtrDeque(&d));
+  bench_report("deque/ptr/rotate", "steady", bench_now_ns() - start, n);
+
+  destroy_PtrDeque(&d);
+}
+
+static void __bench_memory_pool(size_t n) {
+  initialize_memory_pool(1024);
+
+  MPCharDeque d = new_MPCharDeque(1);
+  uint64_t start = bench_now_ns();
+
+  for (size_t i = 0; i < n; ++i)
+    push_back_MPCharDeque(&d, (char) i);
+  bench_report("deque/mp_char/push_back", "grow", bench_now_ns() - start, n);
+
+  start = bench_now_ns();
+  sink = (size_t) as_array_MPCharDeque(&d, NULL);
+  bench_report("deque/mp_char/as_array", "aligned", bench_now_ns() - start, 1);
+
+  destroy_memory_pool();
+}
+
+int main(int argc, char** argv) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1 << 22;
+
+  __bench_char(n);
+  __bench_ptr(n);
+  __bench_memory_pool(n);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+/* bench_jobs.c
+ *
+ * Soak test for the job table: runs a long stream of background job
+ * lifecycles (register, reap every pid, remove) with a window of jobs alive
+ * at once, and checks that the resident set size stays flat once the table
+ * has reached its peak size. Job ids must keep increasing while slots are
+ * reused, including after every job has been removed.
+ *
+ * Usage: bench_jobs [lifecycles] [concurrent jobs]
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "jobs.h"
+
+#define RSS_SLACK_KB 256 // Growth tolerated after warm up
+
+// Resident set size of this process in kilobytes
+static long __rss_kb() {
+  long pages = 0;
+  FILE* f = fopen("/proc/self/statm", "r");
+
+  if (f != NULL) {
+    if (fscanf(f, "%*s %ld", &pages) != 1)
+      pages = 0;
+    fclose(f);
+  }
+
+  return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Starts job i with one to four stages and a command of varying length
+static Job* __start_job(long i, pid_queue* pids, char* command) {
+  int stages = 1 + i % 4;
+  size_t len = 16 + (i * 7919) % 200;
+
+  memset(command, 'a' + i % 26, len);
+  command[len] = '\0';
+
+  empty_pid_queue(pids);
+  for (int s = 0; s < stages; ++s)
+    push_back_pid_queue(pids, (pid_t) (i * 4 + s + 1));
+
+  return add_job(command, pids);
+}
+
+// Reaps every pid of a job the way check_jobs_bg_status does
+static void __finish_job(Job* job) {
+  size_t stages = length_pid_queue(&job->process_ids);
+  pid_t first = peek_front_pid_queue(&job->process_ids);
+  struct rusage rusage = { 0 };
+
+  for (size_t s = 0; s < stages; ++s) {
+    Job* done = job_process_exited(first + s, &rusage);
+
+    if (done != NULL)
+      remove_job(done);
+  }
+}
+
+int main(int argc, char** argv) {
+  long lifecycles = argc > 1 ? atol(argv[1]) : 1000000;
+  int window = argc > 2 ? atoi(argv[2]) : 64;
+  long warmup = lifecycles / 10;
+  int* live = calloc(window, sizeof(int));
+  char command[256];
+  pid_queue pids = new_pid_queue(4);
+  long rss_start = 0;
+  uint64_t start = 0;
+  int last_id = 0;
+  bool ids_increase = true;
+
+  for (long i = 0; i < lifecycles; ++i) {
+    int w = i % window;
+
+    if (i == warmup) {
+      rss_start = __rss_kb();
+      start = bench_now_ns();
+    }
+
+    // Retire the job that held this window position, then reuse it
+    if (live[w] != 0)
+      __finish_job(find_job(live[w]));
+
+    live[w] = __start_job(i, &pids, command)->job_id;
+    ids_increase &= live[w] > last_id;
+    last_id = live[w];
+  }
+
+  uint64_t elapsed = bench_now_ns() - start;
+  long rss_end = __rss_kb();
+  char param[32];
+
+  snprintf(param, sizeof(param), "window=%d", window);
+  bench_report("jobs/lifecycle", param, elapsed, lifecycles - warmup);
+  bench_emit("jobs/rss_growth", param, rss_end - rss_start, "KB", lifecycles - warmup);
+
+  // With the table empty the next job still gets a new id
+  for (int w = 0; w < window; ++w) {
+    if (live[w] != 0)
+      __finish_job(find_job(live[w]));
+  }
+
+  Job* after_empty = __start_job(lifecycles, &pids, command);
+
+  ids_increase &= after_empty->job_id > last_id;
+  __finish_job(after_empty);
+
+  destroy_pid_queue(&pids);
+  destroy_job_table();
+  free(live);
+
+  if (!ids_increase) {
+    fprintf(stderr, "FAIL: a job id was reused\n");
+    return EXIT_FAILURE;
+  }
+
+  if (rss_end - rss_start > RSS_SLACK_KB) {
+    fprintf(stderr, "FAIL: RSS grew by %ld KB over %ld job lifecycles\n",
+            rss_end - rss_start, lifecycles - warmup);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,126 @@
+/* bench_launch.c
+ *
+ * Measures the latency of starting and reaping /bin/true through each launch
+ * engine while quash's heap is grown to different sizes. fork() has to copy
+ * the page tables of every touched page, the other engines do not.
+ *
+ * Every engine must also run an executable script without a #! line through
+ * /bin/sh, as execvp() does, or the benchmark fails.
+ *
+ * Usage: bench_launch [iterations]
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "launch.h"
+
+extern char** environ;
+
+static const size_t heap_sizes_mb[] = { 0, 64, 256, 1024 };
+
+static uint64_t __time_engine(LaunchEngine engine, int iterations) {
+  char* argv[] = { "true", NULL };
+  LaunchFds fds = mk_launch_fds(-1, -1, NULL, NULL, false);
+  uint64_t start = bench_now_ns();
+
+  for (int i = 0; i < iterations; ++i) {
+    pid_t pid = launch_program(engine, "/bin/true", argv, environ, &fds);
+
+    if (pid < 0)
+      exit(EXIT_FAILURE);
+
+    waitpid(pid, NULL, 0);
+  }
+
+  return bench_now_ns() - start;
+}
+
+// Runs `script ok > out` for a script holding `echo $1` and no #! line, and
+// checks that it printed its argument
+static bool __check_script(LaunchEngine engine) {
+  char script[] = "/tmp/quash_bench_script_XXXXXX";
+  char out[] = "/tmp/quash_bench_script_out_XXXXXX";
+  char* argv[] = { script, "ok", NULL };
+  char buf[16] = "";
+  int status = -1;
+  int fd = mkstemp(script);
+  int out_fd = mkstemp(out);
+
+  if (fd < 0 || out_fd < 0) {
+    perror("mkstemp");
+    exit(EXIT_FAILURE);
+  }
+
+  if (write(fd, "echo $1\n", 8) != 8 || fchmod(fd, 0755) != 0) {
+    perror(script);
+    exit(EXIT_FAILURE);
+  }
+
+  close(fd);
+
+  LaunchFds fds = mk_launch_fds(-1, -1, NULL, out, false);
+  pid_t pid = launch_program(engine, script, argv, environ, &fds);
+
+  if (pid > 0)
+    waitpid(pid, &status, 0);
+
+  if (read(out_fd, buf, sizeof(buf) - 1) < 0)
+    buf[0] = '\0';
+
+  close(out_fd);
+  unlink(script);
+  unlink(out);
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || strcmp(buf, "ok\n") != 0) {
+    fprintf(stderr, "FAIL: %s did not run a script without #! through /bin/sh\n",
+            launch_engine_name(engine));
+    return false;
+  }
+
+  return true;
+}
+
+int main(int argc, char** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 200;
+  LaunchEngine engines[] = { LAUNCH_FORK, LAUNCH_VFORK, LAUNCH_SPAWN };
+
+  for (size_t h = 0; h < sizeof(heap_sizes_mb) / sizeof(*heap_sizes_mb); ++h) {
+    size_t size = heap_sizes_mb[h] << 20;
+    char* heap = NULL;
+
+    // Touch every page so it is really mapped into quash
+    if (size != 0) {
+      if ((heap = malloc(size)) == NULL) {
+        fprintf(stderr, "Skipping %zu MB heap: allocation failed\n", heap_sizes_mb[h]);
+        continue;
+      }
+
+      memset(heap, 1, size);
+    }
+
+    for (size_t e = 0; e < sizeof(engines) / sizeof(*engines); ++e) {
+      char name[64];
+      char param[32];
+
+      snprintf(name, sizeof(name), "launch/%s", launch_engine_name(engines[e]));
+      snprintf(param, sizeof(param), "heap=%zuMB", heap_sizes_mb[h]);
+      bench_report(name, param, __time_engine(engines[e], iterations), iterations);
+    }
+
+    free(heap);
+  }
+
+  bool ok = true;
+
+  for (size_t e = 0; e < sizeof(engines) / sizeof(*engines); ++e)
+    ok &= __check_script(engines[e]);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,444 @@
+/* bench_parse.c
+ *
+ * Parser throughput: whole command lines through yyparse (lexing included)
+ * at increasing argument counts, and interpret_complex_string_token on
+ * quoted tokens full of $VAR references, with few and with many variables
+ * defined, and on multi-kilobyte tokens with few special characters.
+ *
+ * The long token rows also run a verbatim copy of the byte at a time
+ * interpret_complex_string_token that the bulk copy replaced, and check that
+ * both produce the same result for a few thousand random tokens. The
+ * benchmark fails if they differ.
+ *
+ * Last, a single line of 100000 arguments and a single pipeline of 10000
+ * stages must parse into the expected commands within a time bound, which
+ * keeps the grammar's stack depth and append cost independent of the line's
+ * length.
+ *
+ * Usage: bench_parse [total arguments]
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "execute.h"
+#include "memory_pool.h"
+#include "parsing_interface.h"
+
+// The builders of the reference interpret_complex_string_token below
+IMPLEMENT_DEQUE_STRUCT(RefBuilder, char);
+IMPLEMENT_DEQUE_MEMORY_POOL(RefBuilder, char);
+IMPLEMENT_DEQUE_STRUCT(RefName, char);
+IMPLEMENT_DEQUE(RefName, char);
+
+static const size_t arg_counts[] = { 1, 16, 256, 4096 };
+
+// Time allowed for each of the long line checks
+#define LONG_LINE_BOUND_NS (2 * 1000000000ULL)
+
+static volatile size_t sink; // Keeps results observable to the compiler
+
+static inline bool __is_first_identifier_char(char c) {
+  return isalpha(c) || c == '_';
+}
+
+static inline bool __is_identifier_char(char c) {
+  return isalnum(c) || c == '_';
+}
+
+// __interpret_deref as it was before the bulk copy fast path
+static void __reference_deref(RefBuilder* bld, const char* str, int* idx) {
+  pop_back_RefBuilder(bld);
+
+  RefName tmp = new_RefName(16);
+  char c;
+
+  while (__is_identifier_char((c = str[++(*idx)])))
+    push_back_RefName(&tmp, c);
+
+  --(*idx);
+
+  push_back_RefName(&tmp, '\0');
+
+  char* id = as_array_RefName(&tmp, NULL);
+  const char* env_var = lookup_env(id);
+
+  free(id);
+
+  if (env_var != NULL) {
+    for (int i = 0; env_var[i] != '\0'; ++i)
+      push_back_RefBuilder(bld, env_var[i]);
+  }
+}
+
+// interpret_complex_string_token as it was before the bulk copy fast path,
+// pushing one byte at a time
+static char* __reference_interpret(const char* str) {
+  RefBuilder bld = new_RefBuilder(64);
+  int i;
+  int len = strlen(str);
+  bool in_quotes = false;
+
+  for (i = 0; i <= len; ++i) {
+    push_back_RefBuilder(&bld, str[i]);
+
+    switch (str[i]) {
+    case '\\':
+      if (!in_quotes) {
+        switch (str[i+1]) {
+        case '\\':
+        case '\'':
+        case '#':
+        case '$':
+        case '=':
+        case '&':
+        case '|':
+        case ';':
+        case ' ':
+        case '\t':
+          update_back_RefBuilder(&bld, str[++i]);
+          break;
+
+        case '\n':
+          pop_back_RefBuilder(&bld);
+          ++i;
+          break;
+
+        default:
+          break;
+        }
+      }
+      else if (str[i+1] == '\'') {
+        update_back_RefBuilder(&bld, '\'');
+        ++i;
+      }
+      break;
+
+    case '\'':
+      in_quotes = !in_quotes;
+      pop_back_RefBuilder(&bld);
+      break;
+
+    case '$':
+      if (!in_quotes && __is_first_identifier_char(str[i + 1]))
+        __reference_deref(&bld, str, &i);
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  update_back_RefBuilder(&bld, '\0');
+
+  return as_array_RefBuilder(&bld, NULL);
+}
+
+// A random token of len bytes with balanced quotes. One byte in `sparsity`
+// starts a special sequence, the rest are letters and slashes.
+static void __random_token(char* token, size_t len, int sparsity) {
+  static const char* specials[] = { "\\x", "\\$", "\\'", "\\ ", "$HOME", "$X_1", "$", "'" };
+  bool in_quotes = false;
+  size_t i = 0;
+
+  while (i < len) {
+    const char* piece = (rand() % sparsity == 0) ? specials[rand() % 8] : NULL;
+    size_t piece_len = piece != NULL ? strlen(piece) : 1;
+
+    if (i + piece_len > len)
+      break;
+
+    if (piece == NULL)
+      token[i] = rand() % 8 == 0 ? '/' : 'a' + rand() % 26; // Path-like filler
+    else
+      memcpy(token + i, piece, piece_len);
+
+    // Only a bare quote toggles quoting, no piece ends in a backslash
+    if (piece != NULL && strcmp(piece, "'") == 0)
+      in_quotes = !in_quotes;
+
+    i += piece_len;
+  }
+
+  if (in_quotes)
+    token[i++] = '\'';
+
+  token[i] = '\0';
+}
+
+// A script of `lines` lines, each a command with `args` arguments
+static char* __make_script(size_t lines, size_t args) {
+  static const char arg[] = " --flag-value";
+  size_t line_len = strlen("program") + args * (sizeof(arg) - 1) + 1;
+  char* script = malloc(lines * line_len + 1);
+  char* pos = script;
+
+  for (size_t l = 0; l < lines; ++l) {
+    pos += sprintf(pos, "program");
+
+    for (size_t a = 0; a < args; ++a)
+      pos += sprintf(pos, "%s", arg);
+
+    *pos++ = '\n';
+  }
+
+  *pos = '\0';
+
+  return script;
+}
+
+static void __bench_yyparse(size_t total_args) {
+  for (size_t i = 0; i < sizeof(arg_counts) / sizeof(*arg_counts); ++i) {
+    size_t args = arg_counts[i];
+    size_t lines = total_args / args ? total_args / args : 1;
+    char* script = __make_script(lines, args);
+    QuashState state = { true, false, true, NULL };
+    char param[32];
+    size_t parsed = 0;
+
+    open_script_string(script);
+
+    uint64_t start = bench_now_ns();
+
+    while (parsed < lines) {
+      if (parse(&state) == NULL)
+        break;
+
+      ++parsed;
+      reset_memory_pool();
+    }
+
+    snprintf(param, sizeof(param), "args=%zu", args);
+    bench_report("parse/yyparse", param, bench_now_ns() - start, parsed);
+    free(script);
+  }
+}
+
+static void __bench_interpret(size_t n) {
+  static const char* tokens[] = {
+    "$HOME/$USER/bin:$PATH",
+    "'literal $HOME' and $SHELL_VAR_0 $SHELL_VAR_1 $SHELL_VAR_2 $SHELL_VAR_3",
+    "pre\\$fix-$HOME-$UNSET_VARIABLE-$USER-suffix",
+  };
+
+  write_env("USER", "quash");
+  write_env("SHELL_VAR_0", "zero");
+  write_env("SHELL_VAR_1", "one");
+  write_env("SHELL_VAR_2", "two");
+  write_env("SHELL_VAR_3", "three");
+
+  uint64_t start = bench_now_ns();
+
+  for (size_t i = 0; i < n; ++i) {
+    sink += (size_t) interpret_complex_string_token(tokens[i % 3]);
+
+    if (i % 256 == 255)
+      reset_memory_pool();
+  }
+
+  bench_report("parse/interpret_token", "$VAR heavy", bench_now_ns() - start, n);
+  reset_memory_pool();
+}
+
+// Defines `vars` variables, then expands references spread across all of them
+static void __bench_many_vars(size_t n, size_t vars) {
+  char name[32];
+  char token[64];
+  char param[32];
+
+  for (size_t v = 0; v < vars; ++v) {
+    snprintf(name, sizeof(name), "MANY_%zu", v);
+    write_env(name, "value");
+  }
+
+  uint64_t start = bench_now_ns();
+
+  for (size_t i = 0; i < n; ++i) {
+    snprintf(token, sizeof(token), "$MANY_%zu/$MANY_%zu", (i * 7) % vars, (i * 13) % vars);
+    sink += (size_t) interpret_complex_string_token(token);
+
+    if (i % 256 == 255)
+      reset_memory_pool();
+  }
+
+  snprintf(param, sizeof(param), "vars=%zu", vars);
+  bench_report("parse/interpret_token", param, bench_now_ns() - start, n);
+  reset_memory_pool();
+}
+
+// Checks the fast path against the reference on random tokens
+static bool __check_interpret() {
+  char token[4096];
+
+  write_env("X_1", "expanded");
+
+  for (int t = 0; t < 4000; ++t) {
+    __random_token(token, 1 + rand() % (sizeof(token) - 2), 1 + t % 64);
+
+    char* fast = interpret_complex_string_token(token);
+    char* ref = __reference_interpret(token);
+
+    if (strcmp(fast, ref) != 0) {
+      fprintf(stderr, "FAIL: interpret_complex_string_token differs for \"%s\"\n", token);
+      return false;
+    }
+
+    reset_memory_pool();
+  }
+
+  return true;
+}
+
+// Multi-kilobyte tokens with a special character every `sparsity` bytes
+static void __bench_long_tokens(size_t n, size_t len, int sparsity) {
+  char* token = malloc(len + 2);
+  char param[32];
+
+  __random_token(token, len, sparsity);
+  snprintf(param, sizeof(param), "%zuB/1 in %d", len, sparsity);
+
+  uint64_t start = bench_now_ns();
+
+  for (size_t i = 0; i < n; ++i) {
+    sink += (size_t) interpret_complex_string_token(token);
+    reset_memory_pool();
+  }
+
+  bench_report("parse/interpret_long", param, bench_now_ns() - start, n);
+
+  start = bench_now_ns();
+
+  for (size_t i = 0; i < n; ++i) {
+    sink += (size_t) __reference_interpret(token);
+    reset_memory_pool();
+  }
+
+  bench_report("parse/interpret_long_ref", param, bench_now_ns() - start, n);
+  free(token);
+}
+
+// Parses a single line and checks the time it took against the bound
+static CommandHolder* __parse_line(const char* line, const char* param) {
+  QuashState state = { true, false, true, NULL };
+  CommandHolder* holders;
+
+  open_script_string(line);
+
+  uint64_t start = bench_now_ns();
+  holders = parse(&state);
+  uint64_t elapsed = bench_now_ns() - start;
+
+  bench_report("parse/long_line", param, elapsed, 1);
+
+  if (holders == NULL) {
+    fprintf(stderr, "FAIL: line with %s did not parse\n", param);
+    return NULL;
+  }
+
+  if (elapsed > LONG_LINE_BOUND_NS) {
+    fprintf(stderr, "FAIL: line with %s took %.2fs to parse\n", param, elapsed / 1e9);
+    return NULL;
+  }
+
+  return holders;
+}
+
+static bool __check_long_args(size_t args) {
+  char* line = __make_script(1, args);
+  char param[32];
+  bool ok = false;
+
+  snprintf(param, sizeof(param), "args=%zu", args);
+
+  CommandHolder* holders = __parse_line(line, param);
+
+  if (holders != NULL) {
+    char** argv = holders[0].cmd.generic.args;
+    size_t n = 0;
+
+    while (argv[n] != NULL)
+      ++n;
+
+    ok = n == args + 1 && strcmp(argv[0], "program") == 0 &&
+      strcmp(argv[args], "--flag-value") == 0 &&
+      get_command_holder_type(holders[1]) == EOC;
+
+    if (!ok)
+      fprintf(stderr, "FAIL: line with %s parsed into %zu arguments\n", param, n);
+  }
+
+  reset_memory_pool();
+  free(line);
+
+  return ok;
+}
+
+static bool __check_long_pipeline(size_t stages) {
+  char* line = malloc(stages * sizeof(" | true") + 8);
+  char* pos = line;
+  char param[32];
+  bool ok = true;
+  size_t n;
+
+  pos += sprintf(pos, "true");
+
+  for (size_t i = 1; i < stages; ++i)
+    pos += sprintf(pos, " | true");
+
+  sprintf(pos, " &\n");
+  snprintf(param, sizeof(param), "stages=%zu", stages);
+
+  CommandHolder* holders = __parse_line(line, param);
+
+  if (holders == NULL) {
+    free(line);
+    return false;
+  }
+
+  for (n = 0; get_command_holder_type(holders[n]) != EOC; ++n) {
+    int flags = holders[n].flags;
+
+    ok = ok && ((n > 0) == !!(flags & PIPE_IN)) &&
+      ((n < stages - 1) == !!(flags & PIPE_OUT));
+  }
+
+  ok = ok && n == stages && (holders[0].flags & BACKGROUND);
+
+  if (!ok)
+    fprintf(stderr, "FAIL: pipeline with %s parsed into %zu wrongly linked commands\n",
+            param, n);
+
+  reset_memory_pool();
+  free(line);
+
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  size_t total_args = argc > 1 ? strtoul(argv[1], NULL, 10) : 1 << 18;
+
+  initialize_memory_pool(1024);
+
+  __bench_yyparse(total_args);
+  __bench_interpret(total_args);
+  __bench_many_vars(total_args, 100);
+  __bench_many_vars(total_args, 10000);
+
+  if (!__check_interpret())
+    return EXIT_FAILURE;
+
+  __bench_long_tokens(total_args / 64, 8192, 1000);
+  __bench_long_tokens(total_args / 64, 8192, 16);
+
+  if (!__check_long_args(100000) || !__check_long_pipeline(10000))
+    return EXIT_FAILURE;
+
+  destroy_parser();
+  destroy_memory_pool();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+/* bench_pipe.c
+ *
+ * Throughput of `producer | consumer` run through quash with the pipe
+ * capacity set by QUASH_PIPEBUF. This binary also plays both ends of the
+ * pipeline when started as `bench_pipe produce MB` or `bench_pipe consume`.
+ *
+ * Usage: bench_pipe [quash binary] [megabytes]
+ */
+
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define CHUNK_SIZE (1 << 20)
+
+extern char** environ;
+
+static const char* buffer_sizes[] = { NULL, "16K", "256K", "1M" };
+
+static int __produce(long mb) {
+  char* chunk = malloc(CHUNK_SIZE);
+
+  memset(chunk, 'q', CHUNK_SIZE);
+
+  for (long i = 0; i < mb; ++i) {
+    for (size_t off = 0; off < CHUNK_SIZE;) {
+      ssize_t n = write(STDOUT_FILENO, chunk + off, CHUNK_SIZE - off);
+
+      if (n < 0)
+        return EXIT_FAILURE;
+
+      off += n;
+    }
+  }
+
+  free(chunk);
+
+  return EXIT_SUCCESS;
+}
+
+static int __consume() {
+  char* chunk = malloc(CHUNK_SIZE);
+
+  while (read(STDIN_FILENO, chunk, CHUNK_SIZE) > 0)
+    ;
+
+  free(chunk);
+
+  return EXIT_SUCCESS;
+}
+
+static uint64_t __run_pipeline(const char* quash, const char* self, long mb,
+                               const char* buffer_size) {
+  char command[2 * PATH_MAX + 64];
+  char* argv[] = { (char*) quash, "-c", command, NULL };
+  pid_t pid;
+
+  snprintf(command, sizeof(command), "%s produce %ld | %s consume", self, mb, self);
+
+  if (buffer_size != NULL)
+    setenv("QUASH_PIPEBUF", buffer_size, 1);
+  else
+    unsetenv("QUASH_PIPEBUF");
+
+  uint64_t start = bench_now_ns();
+
+  if (posix_spawn(&pid, quash, NULL, NULL, argv, environ) != 0) {
+    perror("posix_spawn");
+    exit(EXIT_FAILURE);
+  }
+
+  waitpid(pid, NULL, 0);
+
+  return bench_now_ns() - start;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 2 && strcmp(argv[1], "produce") == 0)
+    return __produce(atol(argv[2]));
+
+  if (argc > 1 && strcmp(argv[1], "consume") == 0)
+    return __consume();
+
+  const char* quash = argc > 1 ? argv[1] : "./quash";
+  long mb = argc > 2 ? atol(argv[2]) : 1024;
+  char self[PATH_MAX];
+  ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+
+  if (len < 0) {
+    perror("readlink");
+    return EXIT_FAILURE;
+  }
+
+  self[len] = '\0';
+
+  for (size_t i = 0; i < sizeof(buffer_sizes) / sizeof(*buffer_sizes); ++i) {
+    bench_report_rate("pipe/throughput", buffer_sizes[i] ? buffer_sizes[i] : "default",
+                      __run_pipeline(quash, self, mb, buffer_sizes[i]),
+                      (uint64_t) mb << 20);
+  }
+
+  return EXIT_SUCCESS;
+}
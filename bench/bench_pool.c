@@ -0,0 +1,97 @@
+/* bench_pool.c
+ *
+ * Microbenchmarks for the memory pool: small default aligned allocations,
+ * byte aligned allocations, strdup, growing the latest allocation in place,
+ * and rewinding the pool between command lines.
+ *
+ * Usage: bench_pool [allocations]
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "memory_pool.h"
+
+#define ALLOCS_PER_LINE 1024 // Allocations between resets, like one command line
+
+static volatile size_t sink; // Keeps results observable to the compiler
+
+static void __bench_alloc(size_t n, size_t align, const char* param) {
+  uint64_t start = bench_now_ns();
+
+  for (size_t i = 0; i < n; ++i) {
+    sink += (size_t) memory_pool_alloc_aligned(8 + i % 57, align);
+
+    if (i % ALLOCS_PER_LINE == ALLOCS_PER_LINE - 1)
+      reset_memory_pool();
+  }
+
+  bench_report("pool/alloc", param, bench_now_ns() - start, n);
+  reset_memory_pool();
+}
+
+static void __bench_strdup(size_t n) {
+  static const char* words[] = { "ls", "--color=auto", "/usr/local/bin/program", "x" };
+  uint64_t start = bench_now_ns();
+
+  for (size_t i = 0; i < n; ++i) {
+    sink += (size_t) memory_pool_strdup(words[i % 4]);
+
+    if (i % ALLOCS_PER_LINE == ALLOCS_PER_LINE - 1)
+      reset_memory_pool();
+  }
+
+  bench_report("pool/strdup", "mixed", bench_now_ns() - start, n);
+  reset_memory_pool();
+}
+
+static void __bench_realloc(size_t n) {
+  size_t size = 16;
+  char* ptr = memory_pool_alloc(size);
+  uint64_t start = bench_now_ns();
+
+  // Doubling the latest allocation, as a growing deque does
+  for (size_t i = 0; i < n; ++i) {
+    if (size >= (1 << 16)) {
+      reset_memory_pool();
+      size = 16;
+      ptr = memory_pool_alloc(size);
+    }
+
+    ptr = memory_pool_realloc(ptr, size, 2 * size);
+    size *= 2;
+  }
+
+  bench_report("pool/realloc", "double", bench_now_ns() - start, n);
+  sink += (size_t) ptr;
+  reset_memory_pool();
+}
+
+static void __bench_reset(size_t n) {
+  uint64_t start = bench_now_ns();
+
+  for (size_t i = 0; i < n; ++i) {
+    sink += (size_t) memory_pool_alloc(64);
+    reset_memory_pool();
+  }
+
+  bench_report("pool/reset", "one chunk", bench_now_ns() - start, n);
+}
+
+int main(int argc, char** argv) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1 << 22;
+
+  initialize_memory_pool(1024);
+
+  __bench_alloc(n, _Alignof(max_align_t), "max_align");
+  __bench_alloc(n, 1, "byte");
+  __bench_strdup(n);
+  __bench_realloc(n / 16);
+  __bench_reset(n);
+
+  destroy_memory_pool();
+
+  return EXIT_SUCCESS;
+}
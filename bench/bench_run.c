@@ -0,0 +1,392 @@
+/* bench_run.c
+ *
+ * End to end latency of run_script: launching and waiting for /bin/true as a
+ * single command and as a two stage pipeline, including the path cache
+ * lookup, pipe setup and reaping done by quash.
+ *
+ * The background row pushes many `true &` lines through the job scheduler
+ * with QUASH_MAXJOBS=4 and waits for all of them to complete. It fails if
+ * more than four jobs ever run at once.
+ *
+ * The parallel row runs `parallel -j 4 true ::: ...` over as many inputs.
+ * A parallel task must also start with SIGCHLD unblocked, read from the
+ * SigBlk line of its /proc/self/status.
+ *
+ * The kill row starts `sh -c 'sleep 30 & sleep 30' &`, then times `kill 9`
+ * and `wait` on the job until the sleep started by sh is gone too. It fails
+ * if that grandchild survives the kill.
+ *
+ * The pipeline rows push a file through a 1000 stage `/bin/cat` pipeline,
+ * once as is and once with a soft RLIMIT_NOFILE too low to hold its pipes.
+ * They fail if the output is short, quash is left holding descriptors, or
+ * the low limit was not raised to fit the pipes.
+ *
+ * Usage: bench_run [iterations] [pipeline megabytes]
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "command.h"
+#include "execute.h"
+#include "launch.h"
+#include "memory_pool.h"
+
+static uint64_t __time_script(CommandHolder* holders, int iterations) {
+  uint64_t start = bench_now_ns();
+
+  for (int i = 0; i < iterations; ++i)
+    run_script(holders);
+
+  return bench_now_ns() - start;
+}
+
+#define MAX_JOBS 4
+
+static int __running_jobs() {
+  int running = 0;
+
+  for (Job* job = first_job(); job != NULL; job = next_job(job))
+    running += !job->pending;
+
+  return running;
+}
+
+// Runs `true &` iterations times, then waits for every job to complete
+static bool __check_background(CommandHolder* holders, int iterations) {
+  int saved = dup(STDOUT_FILENO);
+  int null = open("/dev/null", O_WRONLY);
+  int most = 0;
+  bool ok = true;
+
+  write_env("QUASH_MAXJOBS", "4");
+  fflush(stdout);
+  dup2(null, STDOUT_FILENO); // Job start and completion messages
+  close(null);
+
+  uint64_t start = bench_now_ns();
+
+  for (int i = 0; i < iterations; ++i) {
+    run_script(holders);
+
+    if (__running_jobs() > most)
+      most = __running_jobs();
+  }
+
+  finish_pending_jobs();
+
+  while (first_job() != NULL) {
+    usleep(100);
+    check_jobs_bg_status();
+  }
+
+  uint64_t elapsed = bench_now_ns() - start;
+
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+
+  bench_report("run_script/true &", "maxjobs=4", elapsed, iterations);
+
+  if (most > MAX_JOBS) {
+    fprintf(stderr, "FAIL: %d background jobs ran at once with QUASH_MAXJOBS=4\n", most);
+    ok = false;
+  }
+
+  return ok;
+}
+
+// Runs `parallel grep -e SigBlk -e SigIgn ::: /proc/self/status > out` and
+// checks that the task's mask, inherited across exec, leaves SIGCHLD
+// unblocked, and that SIGPIPE, ignored while parallel runs, is not ignored
+// by the task
+static bool __check_parallel_mask() {
+  char out[] = "/tmp/quash_bench_sigblk_XXXXXX";
+  char* args[] = { "grep", "-e", "SigBlk", "-e", "SigIgn", ":::", "/proc/self/status", NULL };
+  CommandHolder holders[] = {
+    mk_command_holder(NULL, out, REDIRECT_OUT, mk_parallel_command(args)),
+    mk_command_holder(NULL, NULL, 0, mk_eoc())
+  };
+  unsigned long long blocked = ~0ULL;
+  unsigned long long ignored = ~0ULL;
+  int fd = mkstemp(out);
+  FILE* f;
+
+  if (fd < 0) {
+    perror("mkstemp");
+    exit(EXIT_FAILURE);
+  }
+
+  close(fd);
+  run_script(holders);
+
+  if ((f = fopen(out, "r")) != NULL) {
+    if (fscanf(f, "SigBlk: %llx SigIgn: %llx", &blocked, &ignored) != 2)
+      blocked = ignored = ~0ULL;
+    fclose(f);
+  }
+
+  unlink(out);
+
+  if (blocked & (1ULL << (SIGCHLD - 1))) {
+    fprintf(stderr, "FAIL: parallel started a task with SIGCHLD blocked\n");
+    return false;
+  }
+
+  if (ignored & (1ULL << (SIGPIPE - 1))) {
+    fprintf(stderr, "FAIL: parallel started a task with SIGPIPE ignored\n");
+    return false;
+  }
+
+  return true;
+}
+
+#define PIPELINE_STAGES 1000
+#define LOW_FD_LIMIT 64
+
+// Descriptors open in this process
+static int __count_fds() {
+  DIR* dir = opendir("/proc/self/fd");
+  int count = 0;
+
+  if (dir == NULL)
+    return -1;
+
+  while (readdir(dir) != NULL)
+    ++count;
+
+  closedir(dir);
+
+  return count;
+}
+
+// Runs `cat < in | cat | ... | cat > out` and checks that every byte made it
+static bool __run_long_pipeline(CommandHolder* holders, const char* param,
+                                const char* out, off_t bytes) {
+  struct stat st;
+  int fds = __count_fds();
+  uint64_t start = bench_now_ns();
+
+  run_script(holders);
+
+  uint64_t elapsed = bench_now_ns() - start;
+  bool ok = true;
+
+  bench_report_rate("run_script/cat x1000", param, elapsed, bytes);
+
+  if (stat(out, &st) != 0 || st.st_size != bytes) {
+    fprintf(stderr, "FAIL: %d stage pipeline (%s) wrote %lld of %lld bytes\n",
+            PIPELINE_STAGES, param, stat(out, &st) == 0 ? (long long) st.st_size : -1LL,
+            (long long) bytes);
+    ok = false;
+  }
+
+  if (__count_fds() != fds) {
+    fprintf(stderr, "FAIL: %d stage pipeline (%s) left quash with %d descriptors, not %d\n",
+            PIPELINE_STAGES, param, __count_fds(), fds);
+    ok = false;
+  }
+
+  return ok;
+}
+
+// Pushes mb megabytes through a PIPELINE_STAGES stage pipeline, first at the
+// current descriptor limit, then at a soft limit reserve_fds has to raise
+static bool __check_long_pipeline(long mb) {
+  char in[] = "/tmp/quash_bench_pipeline_in_XXXXXX";
+  char out[] = "/tmp/quash_bench_pipeline_out_XXXXXX";
+  char* args[] = { "/bin/cat", NULL };
+  Command cat = mk_generic_command(args);
+  CommandHolder* holders = malloc((PIPELINE_STAGES + 1) * sizeof(CommandHolder));
+  char* chunk = malloc(1 << 20);
+  int in_fd = mkstemp(in);
+  int out_fd = mkstemp(out);
+  struct rlimit saved;
+  bool ok = true;
+
+  if (in_fd < 0 || out_fd < 0) {
+    perror("mkstemp");
+    exit(EXIT_FAILURE);
+  }
+
+  memset(chunk, 'q', 1 << 20);
+
+  for (long i = 0; i < mb; ++i) {
+    if (write(in_fd, chunk, 1 << 20) != 1 << 20) {
+      perror("write");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  close(in_fd);
+  close(out_fd);
+  free(chunk);
+
+  holders[0] = mk_command_holder(in, NULL, REDIRECT_IN | PIPE_OUT, cat);
+
+  for (int i = 1; i < PIPELINE_STAGES - 1; ++i)
+    holders[i] = mk_command_holder(NULL, NULL, PIPE_IN | PIPE_OUT, cat);
+
+  holders[PIPELINE_STAGES - 1] = mk_command_holder(NULL, out, PIPE_IN | REDIRECT_OUT, cat);
+  holders[PIPELINE_STAGES] = mk_command_holder(NULL, NULL, 0, mk_eoc());
+
+  ok &= __run_long_pipeline(holders, "nofile as is", out, (off_t) mb << 20);
+
+  getrlimit(RLIMIT_NOFILE, &saved);
+
+  struct rlimit low = { LOW_FD_LIMIT, saved.rlim_max };
+
+  if (setrlimit(RLIMIT_NOFILE, &low) == 0) {
+    char param[32];
+
+    snprintf(param, sizeof(param), "nofile=%d", LOW_FD_LIMIT);
+    ok &= __run_long_pipeline(holders, param, out, (off_t) mb << 20);
+
+    // Every pipe fits under the hard limit, so none should be made late
+    getrlimit(RLIMIT_NOFILE, &low);
+
+    if (low.rlim_cur < 2 * (PIPELINE_STAGES - 1)) {
+      fprintf(stderr, "FAIL: the soft descriptor limit was left at %llu\n",
+              (unsigned long long) low.rlim_cur);
+      ok = false;
+    }
+
+    setrlimit(RLIMIT_NOFILE, &saved);
+  }
+
+  unlink(in);
+  unlink(out);
+  free(holders);
+
+  return ok;
+}
+
+#define KILL_BOUND_NS 2000000000ULL
+
+// Kills a job whose shell started a process of its own, which only the job's
+// process group still reaches
+static bool __check_kill_group() {
+  char* args[] = { "/bin/sh", "-c", "sleep 30 & sleep 30", NULL };
+  CommandHolder background[] = {
+    mk_command_holder(NULL, NULL, BACKGROUND, mk_generic_command(args)),
+    mk_command_holder(NULL, NULL, 0, mk_eoc())
+  };
+  char job_str[16];
+  char* wait_args[] = { job_str, NULL };
+  int saved = dup(STDOUT_FILENO);
+  int null = open("/dev/null", O_WRONLY);
+
+  prctl(PR_SET_CHILD_SUBREAPER, 1); // The orphaned sleep is reaped here
+  fflush(stdout);
+  dup2(null, STDOUT_FILENO);
+  close(null);
+
+  run_script(background);
+
+  Job* job = first_job();
+  pid_t pgid = job != NULL ? job->pgid : 0;
+
+  snprintf(job_str, sizeof(job_str), "%d", job != NULL ? job->job_id : 0);
+  usleep(50000); // Let sh start its sleep
+
+  uint64_t start = bench_now_ns();
+
+  run_kill(mk_kill_command("9", job_str).kill);
+  run_wait(mk_wait_command(wait_args).wait);
+
+  while (pgid > 0 && killpg(pgid, 0) == 0 && bench_now_ns() - start < KILL_BOUND_NS) {
+    usleep(100);
+    check_jobs_bg_status();
+  }
+
+  uint64_t elapsed = bench_now_ns() - start;
+  bool gone = pgid > 0 && killpg(pgid, 0) != 0;
+
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+
+  bench_report("run_script/kill", "grandchild", elapsed, 1);
+
+  if (!gone) {
+    fprintf(stderr, "FAIL: kill left processes of the job running\n");
+    if (pgid > 0)
+      killpg(pgid, SIGKILL);
+  }
+
+  return gone;
+}
+
+int main(int argc, char** argv) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 500;
+  long pipeline_mb = argc > 2 ? atol(argv[2]) : 32;
+  char* args[] = { "true", NULL };
+  Command cmd = mk_generic_command(args);
+  const char* engine = launch_engine_name(default_launch_engine());
+
+  initialize_memory_pool(1024);
+
+  CommandHolder single[] = {
+    mk_command_holder(NULL, NULL, 0, cmd),
+    mk_command_holder(NULL, NULL, 0, mk_eoc())
+  };
+
+  CommandHolder pipeline[] = {
+    mk_command_holder(NULL, NULL, PIPE_OUT, cmd),
+    mk_command_holder(NULL, NULL, PIPE_IN, cmd),
+    mk_command_holder(NULL, NULL, 0, mk_eoc())
+  };
+
+  run_script(single); // Warm the path cache
+
+  bench_report("run_script/true", engine, __time_script(single, iterations), iterations);
+  bench_report("run_script/true|true", engine, __time_script(pipeline, iterations), iterations);
+
+  CommandHolder background[] = {
+    mk_command_holder(NULL, NULL, BACKGROUND, cmd),
+    mk_command_holder(NULL, NULL, 0, mk_eoc())
+  };
+
+  if (!__check_background(background, iterations))
+    return EXIT_FAILURE;
+
+  char** parallel_args = calloc(iterations + 5, sizeof(char*));
+
+  parallel_args[0] = "-j";
+  parallel_args[1] = "4";
+  parallel_args[2] = "true";
+  parallel_args[3] = ":::";
+
+  for (int i = 0; i < iterations; ++i)
+    parallel_args[4 + i] = "x";
+
+  CommandHolder parallel[] = {
+    mk_command_holder(NULL, NULL, 0, mk_parallel_command(parallel_args)),
+    mk_command_holder(NULL, NULL, 0, mk_eoc())
+  };
+
+  bench_report("run_script/parallel", "-j 4", __time_script(parallel, 1), iterations);
+  free(parallel_args);
+
+  if (!__check_parallel_mask())
+    return EXIT_FAILURE;
+
+  if (!__check_long_pipeline(pipeline_mb))
+    return EXIT_FAILURE;
+
+  if (!__check_kill_group())
+    return EXIT_FAILURE;
+
+  destroy_memory_pool();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,35 @@
+/* bench_shell.c
+ *
+ * Stand-ins for the shell state kept by quash.c, so that benchmarks can link
+ * every other module of quash without pulling in its main().
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "quash.h"
+
+static bool running = true;
+
+bool is_tty() {
+  return false;
+}
+
+bool is_batch() {
+  return false;
+}
+
+void print_prompt() {
+}
+
+char* get_command_string() {
+  return strdup("bench");
+}
+
+bool is_running() {
+  return running;
+}
+
+void end_main_loop() {
+  running = false;
+}
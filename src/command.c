@@ -7,7 +7,7 @@
 // Move the created command into a holder
 CommandHolder mk_command_holder(char* redirect_in,
                                 char* redirect_out,
-                                char flags,
+                                int flags,
                                 Command cmd) {
   return (CommandHolder) {
     redirect_in,
@@ -93,11 +93,83 @@ Command mk_pwd_command() {
 }
 
 // Create JobCommand structure
-Command mk_jobs_command() {
+Command mk_jobs_command(char** args) {
   Command cmd;
 
   cmd.jobs = (JobsCommand) {
-    JOBS
+    JOBS,
+    args
+  };
+
+  return cmd;
+}
+
+// Create HashCommand structure
+Command mk_hash_command(char** args) {
+  Command cmd;
+
+  cmd.hash = (HashCommand) {
+    HASH,
+    args
+  };
+
+  return cmd;
+}
+
+// Create TimesCommand structure
+Command mk_times_command() {
+  Command cmd;
+
+  cmd.times = (TimesCommand) {
+    TIMES
+  };
+
+  return cmd;
+}
+
+// Create ParallelCommand structure
+Command mk_parallel_command(char** args) {
+  Command cmd;
+
+  cmd.parallel = (ParallelCommand) {
+    PARALLEL,
+    args
+  };
+
+  return cmd;
+}
+
+// Create FgCommand structure
+Command mk_fg_command(char** args) {
+  Command cmd;
+
+  cmd.fg = (FgCommand) {
+    FG,
+    args
+  };
+
+  return cmd;
+}
+
+// Create BgCommand structure
+Command mk_bg_command(char** args) {
+  Command cmd;
+
+  cmd.bg = (BgCommand) {
+    BG,
+    args
+  };
+
+  return cmd;
+}
+
+// Create WaitCommand structure
+Command mk_wait_command(char** args) {
+  Command cmd;
+
+  cmd.wait = (WaitCommand) {
+    WAIT,
+    args
   };
 
   return cmd;
@@ -134,6 +206,124 @@ CommandType get_command_holder_type(CommandHolder holder) {
   return get_command_type(holder.cmd);
 }
 
+// Carves the copy made by copy_command_holders out of its block. A first
+// pass with sizing set only adds up the space needed.
+typedef struct HolderCopy {
+  bool sizing;
+  size_t ptrs;  // Pointer slots needed, or handed out so far
+  size_t chars; // String bytes needed, or handed out so far
+  char** ptr_area;
+  char* char_area;
+} HolderCopy;
+
+static char* __copy_str(HolderCopy* c, const char* str) {
+  if (str == NULL)
+    return NULL;
+
+  size_t len = strlen(str) + 1;
+  char* copy = c->sizing ? NULL : memcpy(c->char_area + c->chars, str, len);
+
+  c->chars += len;
+
+  return copy;
+}
+
+static char** __copy_args(HolderCopy* c, char** args) {
+  size_t n = 0;
+
+  if (args == NULL)
+    return NULL;
+
+  while (args[n] != NULL)
+    ++n;
+
+  char** copy = c->sizing ? NULL : c->ptr_area + c->ptrs;
+
+  c->ptrs += n + 1;
+
+  for (size_t i = 0; i < n; ++i) {
+    char* arg = __copy_str(c, args[i]);
+
+    if (copy != NULL)
+      copy[i] = arg;
+  }
+
+  if (copy != NULL)
+    copy[n] = NULL;
+
+  return copy;
+}
+
+static CommandHolder __copy_holder(HolderCopy* c, CommandHolder holder) {
+  holder.redirect_in = __copy_str(c, holder.redirect_in);
+  holder.redirect_out = __copy_str(c, holder.redirect_out);
+
+  switch (get_command_holder_type(holder)) {
+  case GENERIC:
+  case ECHO:
+  case HASH:
+  case JOBS:
+  case PARALLEL:
+  case FG:
+  case BG:
+  case WAIT:
+    holder.cmd.generic.args = __copy_args(c, holder.cmd.generic.args);
+    break;
+
+  case EXPORT:
+    holder.cmd.export.env_var = __copy_str(c, holder.cmd.export.env_var);
+    holder.cmd.export.val = __copy_str(c, holder.cmd.export.val);
+    break;
+
+  case CD:
+    holder.cmd.cd.dir = __copy_str(c, holder.cmd.cd.dir);
+    break;
+
+  case KILL:
+    holder.cmd.kill.sig_str = __copy_str(c, holder.cmd.kill.sig_str);
+    holder.cmd.kill.job_str = __copy_str(c, holder.cmd.kill.job_str);
+    break;
+
+  default:
+    break;
+  }
+
+  return holder;
+}
+
+CommandHolder* copy_command_holders(const CommandHolder* holders) {
+  HolderCopy c = { true, 0, 0, NULL, NULL };
+  size_t count = 0;
+
+  while (get_command_holder_type(holders[count]) != EOC)
+    ++count;
+
+  for (size_t i = 0; i < count; ++i)
+    __copy_holder(&c, holders[i]);
+
+  // Holders first, then the argument arrays, then the strings
+  size_t holder_bytes = (count + 1) * sizeof(CommandHolder);
+  CommandHolder* copy = malloc(holder_bytes + c.ptrs * sizeof(char*) + c.chars);
+
+  if (copy == NULL) {
+    fprintf(stderr, "ERROR: Failed to copy a command\n");
+    exit(EXIT_FAILURE);
+  }
+
+  c.ptr_area = (char**) ((char*) copy + holder_bytes);
+  c.char_area = (char*) (c.ptr_area + c.ptrs);
+  c.sizing = false;
+  c.ptrs = 0;
+  c.chars = 0;
+
+  for (size_t i = 0; i < count; ++i)
+    copy[i] = __copy_holder(&c, holders[i]);
+
+  copy[count] = holders[count];
+
+  return copy;
+}
+
 #ifdef DEBUG
 static void __print_generic_cmd(GenericCommand cmd) {
   if (cmd.args != NULL) {
@@ -195,6 +385,30 @@ static void __print_command(Command cmd) {
     __print_simple_cmd("JOBS");
     break;
 
+  case HASH:
+    __print_simple_cmd("HASH");
+    break;
+
+  case TIMES:
+    __print_simple_cmd("TIMES");
+    break;
+
+  case PARALLEL:
+    __print_simple_cmd("PARALLEL");
+    break;
+
+  case FG:
+    __print_simple_cmd("FG");
+    break;
+
+  case BG:
+    __print_simple_cmd("BG");
+    break;
+
+  case WAIT:
+    __print_simple_cmd("WAIT");
+    break;
+
   case EXIT:
     __print_simple_cmd("EXIT");
     break;
@@ -220,6 +434,9 @@ static void __print_command_holder(CommandHolder holder) {
   else
     printf("FG ");
 
+  if (holder.flags & TIMED)
+    printf("TIMED ");
+
   if (holder.flags & PIPE_IN)
     printf("P_IN ");
 
@@ -9,6 +9,7 @@
 #define PIPE_IN         (0x10)
 #define PIPE_OUT        (0x20)
 #define BACKGROUND      (0x40)
+#define TIMED           (0x80)
 
 
 typedef enum CommandType {
@@ -20,6 +21,12 @@ typedef enum CommandType {
   CD,
   PWD,
   JOBS,
+  HASH,
+  TIMES,
+  PARALLEL,
+  FG,
+  BG,
+  WAIT,
   EXIT
 } CommandType;
 
@@ -35,6 +42,18 @@ typedef struct GenericCommand {
 
 typedef GenericCommand EchoCommand;
 
+typedef GenericCommand HashCommand;
+
+typedef GenericCommand JobsCommand;
+
+typedef GenericCommand ParallelCommand;
+
+typedef GenericCommand FgCommand;
+
+typedef GenericCommand BgCommand;
+
+typedef GenericCommand WaitCommand;
+
 
 typedef struct ExportCommand {
   CommandType type; 
@@ -57,7 +76,7 @@ typedef struct KillCommand {
 
 typedef SimpleCommand PWDCommand;
 
-typedef SimpleCommand JobsCommand;
+typedef SimpleCommand TimesCommand;
 
 typedef SimpleCommand ExitCommand;
 
@@ -67,11 +86,17 @@ typedef union Command {
   SimpleCommand simple;   
   GenericCommand generic; 
   EchoCommand echo;       
+  HashCommand hash;       
   ExportCommand export;   
   CDCommand cd;           
   KillCommand kill;       
   PWDCommand pwd;         
   JobsCommand jobs;       
+  TimesCommand times;     
+  ParallelCommand parallel;
+  FgCommand fg;
+  BgCommand bg;
+  WaitCommand wait;
   ExitCommand exit;       
   EOCCommand eoc;         
 } Command;
@@ -79,11 +104,11 @@ typedef union Command {
 typedef struct CommandHolder {
   char* redirect_in;  
   char* redirect_out; 
-  char flags;         
+  int flags;          
   Command cmd;        
 } CommandHolder;
 
-CommandHolder mk_command_holder(char* redirect_in, char* redirect_out, char flags, Command cmd);
+CommandHolder mk_command_holder(char* redirect_in, char* redirect_out, int flags, Command cmd);
 
 Command mk_generic_command(char** args);
 
@@ -97,7 +122,19 @@ Command mk_kill_command(char* sig, char* job);
 
 Command mk_pwd_command();
 
-Command mk_jobs_command();
+Command mk_jobs_command(char** args);
+
+Command mk_hash_command(char** args);
+
+Command mk_times_command();
+
+Command mk_parallel_command(char** args);
+
+Command mk_fg_command(char** args);
+
+Command mk_bg_command(char** args);
+
+Command mk_wait_command(char** args);
 
 Command mk_exit_command();
 
@@ -108,6 +145,10 @@ CommandType get_command_type(Command cmd);
 
 CommandType get_command_holder_type(CommandHolder holder);
 
+// Copies a parsed line, which lives in the memory pool, into one malloc'd
+// block that outlives the line. Release it with free().
+CommandHolder* copy_command_holders(const CommandHolder* holders);
+
 void debug_print_script(const CommandHolder* holders);
 
 #endif
@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define IMPLEMENT_DEQUE_STRUCT(struct_name, type)                       \
   typedef struct struct_name {                                          \
@@ -27,10 +28,15 @@
   void apply_##struct_name(struct_name*, void (*)(type));               \
   void push_front_##struct_name(struct_name*, type);                    \
   void push_back_##struct_name(struct_name*, type);                     \
+  void push_back_n_##struct_name(struct_name*, type, size_t);           \
+  void append_array_##struct_name(struct_name*, const type*, size_t);   \
   type pop_front_##struct_name(struct_name*);                           \
   type pop_back_##struct_name(struct_name*);                            \
   type peek_front_##struct_name(struct_name*);                          \
   type peek_back_##struct_name(struct_name*);                           \
+  type peek_at_##struct_name(struct_name*, size_t);                     \
+  type* iter_first_##struct_name(struct_name*);                         \
+  type* iter_next_##struct_name(struct_name*, type*);                   \
   void update_front_##struct_name(struct_name*, type);                  \
   void update_back_##struct_name(struct_name*, type);                   \
   void update_and_destroy_front_##struct_name(struct_name*, type);      \
@@ -43,10 +49,11 @@
   struct_name new_##struct_name(size_t init_cap) {                      \
     struct_name ret;                                                    \
                                                                         \
-    if (init_cap > 0)                                                   \
-      ret.cap = init_cap;                                               \
-    else                                                                \
-      ret.cap = 1;                                                      \
+    /* Capacities are powers of two so that indices wrap with a mask */ \
+    ret.cap = 1;                                                        \
+                                                                        \
+    while (ret.cap < init_cap)                                          \
+      ret.cap <<= 1;                                                    \
                                                                         \
     ret.data = (type*) malloc(ret.cap * sizeof(type));                  \
                                                                         \
@@ -104,7 +111,7 @@
   size_t length_##struct_name(struct_name* deq) {                       \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL);                                          \
-    return (deq->back - deq->front + deq->cap) % deq->cap;              \
+    return (deq->back - deq->front) & (deq->cap - 1);                   \
   }                                                                     \
                                                                         \
   static void __reallign_##struct_name(struct_name* deq) {              \
@@ -112,26 +119,35 @@
     assert(deq->data != NULL);                                          \
                                                                         \
     if (deq->front != 0) {                                              \
-      type* old_data = deq->data;                                       \
       size_t len = length_##struct_name(deq);                           \
                                                                         \
-      deq->data = (type*) malloc(deq->cap * sizeof(type));              \
-                                                                        \
-      if (deq->data == NULL) {                                          \
-        fprintf(stderr, "ERROR: Failed to reallocate struct_name"       \
-                " contents");                                           \
-        abort();                                                        \
+      if (deq->front <= deq->back) {                                    \
+        /* Contents are contiguous, slide them to the start */          \
+        memmove(deq->data, deq->data + deq->front, len * sizeof(type)); \
       }                                                                 \
+      else {                                                            \
+        /* Contents wrap around, copy both segments in order */         \
+        type* old_data = deq->data;                                     \
+        size_t head_len = deq->cap - deq->front;                        \
+                                                                        \
+        deq->data = (type*) malloc(deq->cap * sizeof(type));            \
                                                                         \
-      size_t i;                                                         \
+        if (deq->data == NULL) {                                        \
+          fprintf(stderr, "ERROR: Failed to reallocate struct_name"     \
+                  " contents");                                         \
+          abort();                                                      \
+        }                                                               \
                                                                         \
-      for (i = 0; i < len; ++i)                                         \
-        deq->data[i] = old_data[(deq->front + i) % deq->cap];           \
+        memcpy(deq->data, old_data + deq->front,                        \
+               head_len * sizeof(type));                                \
+        memcpy(deq->data + head_len, old_data,                          \
+               deq->back * sizeof(type));                               \
                                                                         \
-      free(old_data);                                                   \
+        free(old_data);                                                 \
+      }                                                                 \
                                                                         \
       deq->front = 0;                                                   \
-      deq->back = i;                                                    \
+      deq->back = len;                                                  \
     }                                                                   \
   }                                                                     \
                                                                         \
@@ -159,36 +175,42 @@
     size_t len = length_##struct_name(deq);                             \
                                                                         \
     for (size_t i = 0; i < len; ++i) {                                  \
-      func(deq->data[(deq->front + i) % deq->cap]);                     \
+      func(deq->data[(deq->front + i) & (deq->cap - 1)]);               \
     }                                                                   \
   }                                                                     \
                                                                         \
-  static void __on_push_##struct_name(struct_name* deq) {               \
-    if (deq->front == (deq->back + 1) % deq->cap) {                     \
-      type* old_data = deq->data;                                       \
-      size_t old_cap = deq->cap;                                        \
+  static void __grow_##struct_name(struct_name* deq, size_t min_cap) {  \
+    size_t old_cap = deq->cap;                                          \
+    size_t new_cap = old_cap;                                           \
                                                                         \
-      deq->cap = 2 * deq->cap;                                          \
-      deq->data = (type*) malloc(deq->cap * sizeof(type));              \
+    while (new_cap < min_cap)                                           \
+      new_cap <<= 1;                                                    \
                                                                         \
-      if (deq->data == NULL) {                                          \
-        fprintf(stderr, "ERROR: Failed to reallocate struct_name"       \
-                " contents\n");                                         \
-        abort();                                                        \
-      }                                                                 \
+    if (new_cap == old_cap)                                             \
+      return;                                                           \
                                                                         \
-      size_t i;                                                         \
+    deq->data = (type*) realloc(deq->data, new_cap * sizeof(type));     \
                                                                         \
-      for (i = 0; i < old_cap - 1; ++i)                                 \
-        deq->data[i] = old_data[(deq->front + i) % old_cap];            \
+    if (deq->data == NULL) {                                            \
+      fprintf(stderr, "ERROR: Failed to reallocate struct_name"         \
+              " contents\n");                                           \
+      abort();                                                          \
+    }                                                                   \
                                                                         \
-      free(old_data);                                                   \
+    deq->cap = new_cap;                                                 \
                                                                         \
-      deq->front = 0;                                                   \
-      deq->back = i;                                                    \
+    /* Move the wrapped around head after the old end */                \
+    if (deq->back < deq->front) {                                       \
+      memcpy(deq->data + old_cap, deq->data, deq->back * sizeof(type)); \
+      deq->back += old_cap;                                             \
     }                                                                   \
   }                                                                     \
                                                                         \
+  static void __on_push_##struct_name(struct_name* deq) {               \
+    if (deq->front == ((deq->back + 1) & (deq->cap - 1)))               \
+      __grow_##struct_name(deq, 2 * deq->cap);                          \
+  }                                                                     \
+                                                                        \
   static void __on_pop_##struct_name(struct_name* deq) {                \
     if (is_empty_##struct_name(deq)) {                                  \
       fprintf(stderr, "ERROR: Cannot pop from of struct_name while it " \
@@ -201,7 +223,7 @@
     assert(deq != NULL);                                                \
     assert(deq->data != NULL);                                          \
     __on_push_##struct_name(deq);                                       \
-    deq->front = (deq->front + deq->cap - 1) % deq->cap;                \
+    deq->front = (deq->front - 1) & (deq->cap - 1);                     \
     deq->data[deq->front] = element;                                    \
   }                                                                     \
                                                                         \
@@ -210,7 +232,39 @@
     assert(deq->data != NULL);                                          \
     __on_push_##struct_name(deq);                                       \
     deq->data[deq->back] = element;                                     \
-    deq->back = (deq->back + 1) % deq->cap;                             \
+    deq->back = (deq->back + 1) & (deq->cap - 1);                       \
+  }                                                                     \
+                                                                        \
+  void push_back_n_##struct_name(struct_name* deq, type element,        \
+                                 size_t n) {                            \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL);                                          \
+                                                                        \
+    /* One slot always stays free to tell full from empty */            \
+    __grow_##struct_name(deq, length_##struct_name(deq) + n + 1);       \
+                                                                        \
+    for (size_t i = 0; i < n; ++i) {                                    \
+      deq->data[deq->back] = element;                                   \
+      deq->back = (deq->back + 1) & (deq->cap - 1);                     \
+    }                                                                   \
+  }                                                                     \
+                                                                        \
+  void append_array_##struct_name(struct_name* deq, const type* arr,    \
+                                  size_t n) {                           \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL);                                          \
+    assert(arr != NULL || n == 0);                                      \
+                                                                        \
+    __grow_##struct_name(deq, length_##struct_name(deq) + n + 1);       \
+                                                                        \
+    size_t first = deq->cap - deq->back;                                \
+                                                                        \
+    if (first > n)                                                      \
+      first = n;                                                        \
+                                                                        \
+    memcpy(deq->data + deq->back, arr, first * sizeof(type));           \
+    memcpy(deq->data, arr + first, (n - first) * sizeof(type));         \
+    deq->back = (deq->back + n) & (deq->cap - 1);                       \
   }                                                                     \
                                                                         \
   type pop_front_##struct_name(struct_name* deq) {                      \
@@ -218,7 +272,7 @@
     assert(deq->data != NULL);                                          \
     __on_pop_##struct_name(deq);                                        \
     size_t old_front = deq->front;                                      \
-    deq->front = (deq->front + 1) % deq->cap;                           \
+    deq->front = (deq->front + 1) & (deq->cap - 1);                     \
     return deq->data[old_front];                                        \
   }                                                                     \
                                                                         \
@@ -226,7 +280,7 @@
     assert(deq != NULL);                                                \
     assert(deq->data != NULL);                                          \
     __on_pop_##struct_name(deq);                                        \
-    deq->back = (deq->back + deq->cap - 1) % deq->cap;                  \
+    deq->back = (deq->back - 1) & (deq->cap - 1);                       \
     return deq->data[deq->back];                                        \
   }                                                                     \
                                                                         \
@@ -241,7 +295,31 @@
     assert(deq != NULL);                                                \
     assert(deq->data != NULL);                                          \
     assert(!is_empty_##struct_name(deq));                               \
-    return deq->data[(deq->back + deq->cap - 1) % deq->cap];            \
+    return deq->data[(deq->back - 1) & (deq->cap - 1)];                 \
+  }                                                                     \
+                                                                        \
+  type peek_at_##struct_name(struct_name* deq, size_t idx) {            \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL);                                          \
+    assert(idx < length_##struct_name(deq));                            \
+    return deq->data[(deq->front + idx) & (deq->cap - 1)];              \
+  }                                                                     \
+                                                                        \
+  type* iter_first_##struct_name(struct_name* deq) {                    \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL);                                          \
+    return is_empty_##struct_name(deq) ? NULL                           \
+                                       : &deq->data[deq->front];        \
+  }                                                                     \
+                                                                        \
+  type* iter_next_##struct_name(struct_name* deq, type* it) {           \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL);                                          \
+    assert(it != NULL);                                                 \
+                                                                        \
+    size_t idx = (it - deq->data + 1) & (deq->cap - 1);                 \
+                                                                        \
+    return idx == deq->back ? NULL : &deq->data[idx];                   \
   }                                                                     \
                                                                         \
   void update_front_##struct_name(struct_name* deq, type element) {     \
@@ -255,7 +333,7 @@
     assert(deq != NULL);                                                \
     assert(deq->data != NULL);                                          \
     assert(!is_empty_##struct_name(deq));                               \
-    deq->data[(deq->back + deq->cap - 1) % deq->cap] = element;         \
+    deq->data[(deq->back - 1) & (deq->cap - 1)] = element;              \
   }                                                                     \
                                                                         \
   void update_and_destroy_front_##struct_name(struct_name* deq,         \
@@ -278,7 +356,7 @@
     assert(deq->data != NULL);                                          \
     assert(!is_empty_##struct_name(deq));                               \
                                                                         \
-    size_t idx = (deq->back + deq->cap - 1) % deq->cap;                 \
+    size_t idx = (deq->back - 1) & (deq->cap - 1);                      \
                                                                         \
     if (deq->destructor != NULL)                                        \
       deq->destructor(deq->data[idx]);                                  \
@@ -286,7 +364,6 @@
     deq->data[idx] = element;                                           \
   }
 
-
 typedef char Type;
 
 typedef struct Example {
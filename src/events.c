@@ -0,0 +1,194 @@
+/* events.c
+ *
+ * The loop quash waits in for its next line of input. Flex asks
+ * events_read() for more bytes, which sleeps in one epoll set holding stdin,
+ * a pidfd for every process of a background job and a timerfd for the idle
+ * timeout. A job is reported as soon as its last process exits, even while
+ * quash sits at the prompt, rather than when the next line is read.
+ *
+ * Scripts and -c strings are lexed from memory and never wait, so the loop
+ * is only opened for stdin. Input epoll cannot watch, such as a regular file
+ * redirected to stdin, is read directly since it never blocks.
+ */
+
+#define _GNU_SOURCE // syscall()
+
+#include "events.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "execute.h"
+
+#define EVENT_BATCH 16
+
+// What a ready descriptor is for, kept in the top bits of its epoll data
+#define EVENT_INPUT 0ULL
+#define EVENT_TIMER 1ULL
+#define EVENT_CHILD 2ULL
+
+static int epoll_fd = -1;
+static int input_fd = STDIN_FILENO;
+static int timer_fd = -1;
+static bool timer_armed = false;
+
+static inline uint64_t __pack(uint64_t kind, int fd, pid_t pid) {
+  return kind << 62 | (uint64_t) (uint32_t) fd << 32 | (uint32_t) pid;
+}
+
+static bool __watch(int fd, uint64_t data) {
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN;
+  ev.data.u64 = data;
+
+  return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+void events_open(int fd) {
+  input_fd = fd;
+
+  if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    return;
+
+  // Regular files are refused, and are always ready anyway
+  if (!__watch(fd, __pack(EVENT_INPUT, fd, 0))) {
+    events_close();
+    return;
+  }
+
+  if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) >= 0 &&
+      !__watch(timer_fd, __pack(EVENT_TIMER, timer_fd, 0))) {
+    close(timer_fd);
+    timer_fd = -1;
+  }
+}
+
+void events_close() {
+  if (timer_fd >= 0)
+    close(timer_fd);
+
+  if (epoll_fd >= 0)
+    close(epoll_fd);
+
+  timer_fd = epoll_fd = -1;
+}
+
+void events_watch_child(pid_t pid) {
+  if (epoll_fd < 0)
+    return;
+
+#ifdef SYS_pidfd_open
+  int fd = syscall(SYS_pidfd_open, pid, 0); // Always close-on-exec
+
+  // Without a pidfd the job is still reaped at the next line
+  if (fd >= 0 && !__watch(fd, __pack(EVENT_CHILD, fd, pid)))
+    close(fd);
+#endif
+}
+
+// A watched process has exited. Its pidfd is dropped from the set by hand,
+// since a child forked for a builtin may hold a copy of it.
+static void __child_exited(int fd, pid_t pid) {
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+  close(fd);
+
+  reap_job_process(pid); // Nothing to do if the reaper got there first
+}
+
+// Arms the idle timeout from $QUASH_TMOUT, in seconds, or disarms it. A new
+// setting also clears an expiry left over from before the last line ran.
+static void __arm_timer() {
+  const char* setting = lookup_env("QUASH_TMOUT");
+  long seconds = 0;
+  char* end;
+
+  if (setting != NULL && *setting != '\0') {
+    seconds = strtol(setting, &end, 10);
+
+    if (seconds < 0 || *end != '\0') {
+      fprintf(stderr, "WARNING: Ignoring invalid QUASH_TMOUT \"%s\"\n", setting);
+      seconds = 0;
+    }
+  }
+
+  if (timer_fd < 0 || (seconds == 0 && !timer_armed))
+    return;
+
+  struct itimerspec spec = { { 0, 0 }, { seconds, 0 } };
+
+  timerfd_settime(timer_fd, 0, &spec, NULL);
+  timer_armed = seconds > 0;
+}
+
+static ssize_t __read_input(char* buf, size_t max) {
+  ssize_t n;
+
+  while ((n = read(input_fd, buf, max)) < 0 && errno == EINTR)
+    ;
+
+  return n;
+}
+
+ssize_t events_read(char* buf, size_t max) {
+  struct epoll_event events[EVENT_BATCH];
+
+  if (epoll_fd < 0)
+    return __read_input(buf, max);
+
+  __arm_timer();
+
+  for (;;) {
+    int ready = epoll_wait(epoll_fd, events, EVENT_BATCH, -1);
+    bool input_ready = false;
+    bool timed_out = false;
+
+    if (ready < 0 && errno != EINTR) {
+      perror("ERROR: Failed to wait for input");
+      return __read_input(buf, max);
+    }
+
+    for (int i = 0; i < ready; ++i) {
+      uint64_t data = events[i].data.u64;
+      int fd = (int) (data >> 32 & 0x3fffffff);
+
+      switch (data >> 62) {
+      case EVENT_INPUT:
+        input_ready = true; // Also set on a hang up, which reads as the end
+        break;
+
+      case EVENT_TIMER: {
+        uint64_t expirations;
+
+        if (read(timer_fd, &expirations, sizeof(expirations)) > 0)
+          timed_out = timer_armed;
+        break;
+      }
+
+      case EVENT_CHILD:
+        __child_exited(fd, (pid_t) (uint32_t) data);
+        break;
+
+      default:
+        break;
+      }
+    }
+
+    // Input that arrived with the expiry still counts
+    if (input_ready)
+      return __read_input(buf, max);
+
+    if (timed_out) {
+      fprintf(stderr, "\nquash: timed out waiting for input\n");
+      timer_armed = false;
+      return 0;
+    }
+  }
+}
@@ -0,0 +1,20 @@
+#ifndef SRC_EVENTS_H
+#define SRC_EVENTS_H
+
+#include <sys/types.h>
+
+// Starts the event loop over fd, the descriptor commands are read from
+void events_open(int fd);
+
+void events_close();
+
+// Wakes the loop when pid exits, so its job is reported right away. Does
+// nothing if the loop is not open.
+void events_watch_child(pid_t pid);
+
+// Reads up to max bytes of input like read(2), handling child exits and the
+// $QUASH_TMOUT idle timeout while it waits. Returns 0 at the end of input or
+// once the timeout expires.
+ssize_t events_read(char* buf, size_t max);
+
+#endif
@@ -8,43 +8,83 @@
  * commands like `cd`, `pwd`, `echo`, and managing job status.
  */
 
+#define _GNU_SOURCE // pipe2()
+
 #include "execute.h"
 
+#include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <string.h>  
 #include <limits.h>  
+#include <ctype.h>
+#include <errno.h>
 
 #include "quash.h"
 #include "deque.h"
+#include "events.h"
+#include "fast_builtins.h"
+#include "path_cache.h"
+#include "launch.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "trace.h"
+#include "var_store.h"
 
 #define READ_END 0
 #define WRITE_END 1
 
-// Define a queue for process IDs
-IMPLEMENT_DEQUE_STRUCT(pid_queue, pid_t);
-IMPLEMENT_DEQUE(pid_queue, pid_t);
-pid_queue process_id_queue;
-
-// Define the structure for a Job
-struct Job {
-    int job_id;         // Unique job identifier
-    char* command;      // Command string associated with the job
-    pid_queue process_ids; // Queue of process IDs for the job
-    pid_t first_pid;    // First process ID of the job
-} Job;
-
-// Define a queue for jobs
-IMPLEMENT_DEQUE_STRUCT(job_queue, struct Job);
-IMPLEMENT_DEQUE(job_queue, struct Job);
-job_queue job_list; // Global job queue
-int job_count = 1;  // Job counter
+pid_queue process_id_queue; // Processes started for the current command, reused every line
 
 bool is_initialized = false; // Flag to check initialization status
-static int pipes[2][2]; // Pipe array for inter-process communication
+static LaunchEngine launch_engine; // How external programs are started
+static bool fork_builtins = false; // Run every builtin in a child, as before
+static bool fast_builtins = true; // Stand in for cat, head, wc and seq
+static volatile sig_atomic_t child_exited = 0; // Set by SIGCHLD, cleared when reaping
+static bool job_control = false; // Foreground lines get the terminal, on an interactive terminal only
+
+// Process group the stages of the current line join: 0 until its first stage
+// starts and leads it, -1 to stay in quash's group
+static pid_t line_pgid = -1;
+static bool line_terminal = false; // The line's group takes the terminal
+
+// Every pipe of the current pipeline, created before the first stage starts.
+// Pipe i joins stage i to stage i + 1. Ends are set to -1 once closed.
+typedef struct PipePlan {
+    int (*fds)[2];
+    int count;   // Pipes in the pipeline
+    int created; // Pipes made so far, less than count only when out of fds
+    long buffer_size; // Capacity given to each pipe, 0 for the kernel default
+} PipePlan;
+
+static PipePlan pipe_plan = { NULL, 0, 0, 0 };
+
+// A background line waiting for a job slot. The parsed line lives in the
+// memory pool, so script is a copy made by copy_command_holders().
+typedef struct PendingJob {
+    int job_id;
+    CommandHolder* script;
+} PendingJob;
+
+IMPLEMENT_DEQUE_STRUCT(pending_queue, PendingJob);
+IMPLEMENT_DEQUE(pending_queue, PendingJob);
+
+static pending_queue pending_jobs; // Started in order as running jobs finish
+static long running_jobs = 0; // Started jobs that are not stopped
+static long job_limit = 0; // max_jobs() as read at the start of the current line
+static bool defer_pending_jobs = false; // Set while a line is half launched
+
+static void start_pending_jobs();
+static void cancel_pending_job(Job* job);
+static long max_jobs();
+
+static long pipe_max_size = -1; // Read from /proc once, 0 if unknown
+static bool pipe_size_warned = false; // A refused QUASH_PIPEBUF is reported once
 
 /***************************************************************************
  * Interface Functions
@@ -56,36 +96,234 @@ char* get_current_directory(bool* should_free) {
     return wd;
 }
 
-// Returns the value of an environment variable
+// Returns the value of a shell variable from the hashed store
 const char* lookup_env(const char* env_var) {
-    return getenv(env_var);
+    return var_store_get(env_var);
 }
 
-// Check the status of background jobs
-void check_jobs_bg_status() {
-    // Loop through jobs in the job queue
-    int total_jobs = length_job_queue(&job_list);
-    for (int j = 0; j < total_jobs; j++) {
-        struct Job current_job = pop_front_job_queue(&job_list);
-
-        // Loop through process IDs for the current job
-        int total_pids = length_pid_queue(&current_job.process_ids);
-        pid_t front_pid = peek_front_pid_queue(&current_job.process_ids);
-        for (int p = 0; p < total_pids; p++) {
-            pid_t current_pid = pop_front_pid_queue(&current_job.process_ids);
-            int status;
-            // Check if the child process has finished
-            if (waitpid(current_pid, &status, WNOHANG) == 0) {
-                push_back_pid_queue(&current_job.process_ids, current_pid); // Still running
+// Returns the value of a shell variable whose name is not NUL terminated
+const char* lookup_env_n(const char* env_var, size_t len) {
+    return var_store_get_n(env_var, len);
+}
+
+// Reads a byte count such as 65536, 256K, 1M or 2G. Returns false if str is
+// not a positive size that fits in a long.
+bool parse_size(const char* str, long* size) {
+    char* end;
+    int shift = 0;
+
+    errno = 0;
+    *size = strtol(str, &end, 10);
+
+    switch (toupper((unsigned char) *end)) {
+        case 'K':
+            shift = 10;
+            ++end;
+            break;
+
+        case 'M':
+            shift = 20;
+            ++end;
+            break;
+
+        case 'G':
+            shift = 30;
+            ++end;
+            break;
+
+        default:
+            break;
+    }
+
+    if (*size <= 0 || errno == ERANGE || *end != '\0' || *size > (LONG_MAX >> shift))
+        return false;
+
+    *size <<= shift;
+    return true;
+}
+
+// Sets a shell variable. Children see it through the next envp built.
+void write_env(const char* env_var, const char* val) {
+    var_store_set(env_var, val);
+}
+
+// Only records that a child changed state, reaping happens outside the handler
+static void sigchld_handler(int sig) {
+    (void) sig;
+    child_exited = 1;
+}
+
+// Installs the SIGCHLD handler that drives background job reaping. Stops
+// and continues are reported too, so jobs shows whether a job is stopped.
+static void install_sigchld_handler() {
+    struct sigaction sa;
+
+    sa.sa_handler = sigchld_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART; // Don't break blocking reads
+    sigaction(SIGCHLD, &sa, NULL);
+}
+
+// Turns job control on when quash owns the terminal it reads from. quash
+// then ignores the signals that would stop it when a job has the terminal,
+// and every child gets them back in the launch engines.
+static void init_job_control() {
+    job_control = is_tty() && tcgetpgrp(STDIN_FILENO) == getpgrp();
+
+    if (!job_control)
+        return;
+
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+}
+
+// Gives the terminal to a process group, under job control only
+static void give_terminal(pid_t pgid) {
+    if (job_control && pgid > 0)
+        tcsetpgrp(STDIN_FILENO, pgid);
+}
+
+// Takes the terminal back from a foreground job
+static void take_terminal() {
+    if (job_control)
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+}
+
+// Sends a signal to every process of a job. One killpg reaches the whole
+// pipeline and anything its stages started.
+static void signal_job(Job* job, int signal) {
+    if (job->pgid > 0) {
+        killpg(job->pgid, signal);
+        return;
+    }
+
+    // Stopped foreground lines without job control share quash's group
+    size_t total_pids = length_pid_queue(&job->process_ids);
+    for (size_t p = 0; p < total_pids; p++) {
+        pid_t pid = peek_at_pid_queue(&job->process_ids, p);
+        if (find_job_by_pid(pid) == job)
+            kill(pid, signal);
+    }
+}
+
+// Marks a started job stopped or continued. Only running jobs count against
+// QUASH_MAXJOBS, so a job that stops frees its slot for a pending one.
+static void set_job_stopped(Job* job, bool stopped) {
+    if (job->stopped == stopped)
+        return;
+
+    job->stopped = stopped;
+    running_jobs += stopped ? -1 : 1;
+}
+
+// Reports a job and releases it once its last process has been reaped
+static void complete_job(Job* job, bool report) {
+    if (report)
+        print_job_bg_complete(job->job_id, job->first_pid, job->command);
+    if (job->timed)
+        print_time_report(&job->usage);
+    if (!job->stopped)
+        --running_jobs; // A job killed while stopped held no slot
+    remove_job(job);
+}
+
+// Reaps exited children, reporting the jobs they complete, then starts
+// pending jobs in the slots that freed up. With block set, waits for the
+// first child to exit, stop or continue. Returns the number of changes
+// seen, which when blocking is 0 only if there is no child left.
+static int reap_children(bool block) {
+    pid_t pid;
+    int status;
+    struct rusage rusage;
+    int options = (block ? 0 : WNOHANG) | WUNTRACED | WCONTINUED;
+    int changes = 0;
+
+    while ((pid = wait4(-1, &status, options, &rusage)) > 0) {
+        options |= WNOHANG; // Only block for the first one
+        ++changes;
+
+        if (WIFSTOPPED(status) || WIFCONTINUED(status)) {
+            Job* job = find_job_by_pid(pid);
+
+            if (job != NULL && job->stopped != (bool) WIFSTOPPED(status)) {
+                set_job_stopped(job, WIFSTOPPED(status));
+                if (job->stopped)
+                    print_job_stopped(job->job_id, job->first_pid, job->command);
             }
+            continue;
         }
 
-        // If there are no more PIDs, the job is complete
-        if (is_empty_pid_queue(&current_job.process_ids)) {
-            print_job_bg_complete(current_job.job_id, front_pid, current_job.command);
-        } else {
-            push_back_job_queue(&job_list, current_job); // Still running job
-        }
+        trace_instant("reap", pid, NULL);
+
+        Job* job = job_process_exited(pid, &rusage); // Set if pid was the job's last process
+
+        if (job != NULL)
+            complete_job(job, true);
+    }
+
+    start_pending_jobs();
+
+    return changes;
+}
+
+// Reaps a background process as soon as the event loop sees it exit. A job
+// it completes is reported on a line of its own, and the prompt shown again.
+void reap_job_process(pid_t pid) {
+    int status;
+    struct rusage rusage;
+
+    // The index lookup is what makes this safe. reap_children or run_script
+    // may already have reaped pid, after which the kernel can hand the pid to
+    // an unrelated process. Reaping drops pid from the index, so only a pid
+    // still indexed is one of our unreaped children.
+    if (find_job_by_pid(pid) == NULL || wait4(pid, &status, WNOHANG, &rusage) != pid)
+        return;
+
+    trace_instant("reap", pid, NULL);
+
+    Job* job = job_process_exited(pid, &rusage);
+
+    if (job == NULL)
+        return;
+
+    if (is_tty())
+        putchar('\n'); // Off the prompt line
+    complete_job(job, true);
+    start_pending_jobs();
+    if (is_tty())
+        print_prompt();
+}
+
+// Has the event loop report every process of a job as it exits
+static void watch_job(Job* job) {
+    for (pid_t* pid = iter_first_pid_queue(&job->process_ids); pid != NULL;
+         pid = iter_next_pid_queue(&job->process_ids, pid))
+        events_watch_child(*pid);
+}
+
+// Reap every child that exited since the last call. Costs nothing if no
+// SIGCHLD has arrived.
+void check_jobs_bg_status() {
+    if (!child_exited)
+        return;
+
+    child_exited = 0; // Clear first so an exit during the loop is not lost
+
+    reap_children(false);
+}
+
+// Starts every job still pending before quash exits, waiting for running
+// jobs to finish to make room for them
+void finish_pending_jobs() {
+    if (!is_initialized || is_empty_pending_queue(&pending_jobs))
+        return;
+
+    start_pending_jobs(); // Stopped jobs hold no slot, so some may start now
+
+    while (!is_empty_pending_queue(&pending_jobs)) {
+        if (reap_children(true) == 0)
+            running_jobs = 0; // Nothing left to wait for, so every slot is free
     }
 }
 
@@ -102,44 +340,95 @@ void print_job_bg_start(int job_id, pid_t pid, const char* command) {
     print_job(job_id, pid, command);
 }
 
+// Prints a message for a background job waiting for a free slot
+void print_job_bg_pending(int job_id, const char* command) {
+    printf("Background job pending: [%d]\t%8s\t%s\n", job_id, "pending", command);
+    fflush(stdout);
+}
+
 // Prints a completion message followed by the print job
 void print_job_bg_complete(int job_id, pid_t pid, const char* command) {
     printf("Completed: \t");
     print_job(job_id, pid, command);
 }
 
+// Prints a message for a job stopped by a signal, such as ^Z
+void print_job_stopped(int job_id, pid_t pid, const char* command) {
+    printf("Stopped: \t");
+    print_job(job_id, pid, command);
+}
+
+// Prints a duration the way `time` does, as minutes and seconds
+static void print_duration(FILE* out, double seconds) {
+    int minutes = (int) (seconds / 60);
+
+    fprintf(out, "%dm%.3fs", minutes, seconds - 60.0 * minutes);
+}
+
+static double timeval_seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Prints the CPU, memory and wall clock usage of a job on one line
+void print_job_usage(const Job* job) {
+    printf("[%d]\t%8d\tcpu %.3fs\trss %ldK\telapsed %.3fs\t%s\n",
+           job->job_id, job->first_pid,
+           timeval_seconds(job->usage.utime) + timeval_seconds(job->usage.stime),
+           job->usage.maxrss,
+           job_usage_elapsed_ns(&job->usage) / 1e9,
+           job->command);
+}
+
+// Prints the report of the `time` keyword to stderr
+void print_time_report(const JobUsage* usage) {
+    fprintf(stderr, "\nreal\t");
+    print_duration(stderr, job_usage_elapsed_ns(usage) / 1e9);
+    fprintf(stderr, "\nuser\t");
+    print_duration(stderr, timeval_seconds(usage->utime));
+    fprintf(stderr, "\nsys\t");
+    print_duration(stderr, timeval_seconds(usage->stime));
+    fprintf(stderr, "\nmaxrss\t%ldK\n", usage->maxrss);
+}
+
 /***************************************************************************
  * Functions to process commands
  ***************************************************************************/
-// Run a program reachable by the path environment variable, relative path, or absolute path
-void run_generic(GenericCommand cmd) {
-    char* executable = cmd.args[0]; // First argument as executable
-    char** args = cmd.args;          // Arguments array
-
-    // Check if the command is an absolute or relative path
-    if (executable[0] == '/' || executable[0] == '.') {
-        execvp(executable, args); // Execute command directly
-    } else {
-        // Search for the command in the PATH
-        char* path = getenv("PATH");
-        char* path_copy = strdup(path);
-        char* token = strtok(path_copy, ":");
-
-        while (token != NULL) {
-            char full_path[PATH_MAX];
-            snprintf(full_path, sizeof(full_path), "%s/%s", token, executable);
-
-            if (access(full_path, X_OK) == 0) { // Check if executable
-                execvp(full_path, args);
-                break;
-            }
+// Finds the executable for a command name in quash, printing an error if
+// there is none. This is the only path cache lookup for a command, so its
+// hits and misses are counted once and never in a child.
+static const char* resolve_program(const char* name) {
+    const char* path = name;
 
-            token = strtok(NULL, ":");
-        }
+    // Absolute and relative paths are used as they are
+    if (strchr(name, '/') == NULL && (path = path_cache_lookup(name)) == NULL)
+        fprintf(stderr, "ERROR: %s: command not found\n", name);
+
+    return path;
+}
+
+// Checks if quash may stand in for the program at path, parsing the call
+// into fast. Only the system's own cat, head, wc and seq are replaced, so a
+// program of the same name found earlier in the PATH still runs.
+static bool can_stand_in(char** args, const char* path, FastBuiltin* fast) {
+    static const char* system_dirs[] = { "/bin/", "/usr/bin/" };
+
+    if (!fast_builtins)
+        return false;
 
-        free(path_copy); // Free duplicated path string
+    for (size_t i = 0; i < sizeof(system_dirs) / sizeof(*system_dirs); ++i) {
+        size_t len = strlen(system_dirs[i]);
+
+        if (strncmp(path, system_dirs[i], len) == 0 && strcmp(path + len, args[0]) == 0)
+            return fast_builtin_parse(args, fast);
     }
 
+    return false;
+}
+
+// Run a program at the path quash resolved for it
+void run_generic(GenericCommand cmd, const char* path) {
+    exec_program(path, cmd.args, var_store_envp());
+
     perror("ERROR: Failed to execute program"); // Print error if execution fails
     exit(EXIT_FAILURE);
 }
@@ -158,7 +447,12 @@ void run_echo(EchoCommand cmd) {
 void run_export(ExportCommand cmd) {
     const char* env_var = cmd.env_var; // Get environment variable name
     const char* value = cmd.val;        // Get environment variable value
-    setenv(env_var, value, 1);          // Set the environment variable
+    write_env(env_var, value);          // Set the environment variable
+
+    if (strcmp(env_var, "PATH") == 0)
+        path_cache_clear(); // Cached locations are stale under a new PATH
+    else if (strcmp(env_var, "QUASH_MAXJOBS") == 0)
+        job_limit = max_jobs(); // Pending jobs may start before the next line
 }
 
 // Changes the current working directory
@@ -175,8 +469,8 @@ void run_cd(CDCommand cmd) {
     realpath(directory, resolved_path); // Resolve the absolute path
     chdir(resolved_path); // Change directory
     char cwd[1024];
-    setenv("OLD_PWD", getcwd(cwd, sizeof(cwd)), 1); // Save old working directory
-    setenv("PWD", directory, 1); // Set new working directory
+    write_env("OLD_PWD", getcwd(cwd, sizeof(cwd))); // Save old working directory
+    write_env("PWD", directory); // Set new working directory
 }
 
 // Sends a signal to all processes contained in a job
@@ -184,20 +478,205 @@ void run_kill(KillCommand cmd) {
     int signal = cmd.sig; // Signal to send
     int job_id = cmd.job; // Job identifier
 
-    struct Job current_job;
-
-    // Find the job in the job list
-    for (int j = 0; j < length_job_queue(&job_list); j++) {
-        current_job = pop_front_job_queue(&job_list);
-        if (current_job.job_id == job_id) {
-            // Kill all processes in the job
-            pid_queue current_process_ids = current_job.process_ids;
-            while (length_pid_queue(&current_process_ids) != 0) {
-                pid_t current_pid = pop_front_pid_queue(&current_process_ids);
-                kill(current_pid, signal);
+    Job* job = find_job(job_id); // Direct lookup in the job table
+
+    if (job == NULL) {
+        fprintf(stderr, "kill: %d: no such job\n", job_id);
+        return;
+    }
+
+    if (job->pending) {
+        cancel_pending_job(job); // Never started, so there is nothing to signal
+        return;
+    }
+
+    signal_job(job, signal);
+
+    // A stopped job only acts on the signal once it runs again
+    if (job->stopped && signal != SIGSTOP && signal != SIGTSTP && signal != SIGCONT)
+        signal_job(job, SIGCONT);
+}
+
+// Reads a job named %N or N. Returns false, with an error printed, if spec
+// is not a job number.
+static bool parse_job_spec(const char* builtin, const char* spec, int* job_id) {
+    const char* digits = spec + (spec[0] == '%');
+    char* end;
+    long id = strtol(digits, &end, 10);
+
+    if (*digits == '\0' || *end != '\0' || id < 1 || id > INT_MAX) {
+        fprintf(stderr, "%s: %s: not a job number\n", builtin, spec);
+        return false;
+    }
+
+    *job_id = (int) id;
+    return true;
+}
+
+// Finds the job named by %N or N, printing an error if there is none
+static Job* find_job_spec(const char* builtin, const char* spec) {
+    int job_id;
+    Job* job;
+
+    if (!parse_job_spec(builtin, spec, &job_id))
+        return NULL;
+
+    if ((job = find_job(job_id)) == NULL)
+        fprintf(stderr, "%s: %s: no such job\n", builtin, spec);
+
+    return job;
+}
+
+// The job named by the only argument of fg or bg, or the newest started job
+static Job* find_job_arg(const char* builtin, char** args) {
+    Job* newest = NULL;
+
+    if (args[0] != NULL)
+        return find_job_spec(builtin, args[0]);
+
+    for (Job* job = first_job(); job != NULL; job = next_job(job)) {
+        if (!job->pending)
+            newest = job;
+    }
+
+    if (newest == NULL)
+        fprintf(stderr, "%s: no current job\n", builtin);
+
+    return newest;
+}
+
+// Waits until every process of a started job has exited, or one stops.
+// Returns true if the job is complete, and it still has to be released.
+static bool wait_job(Job* job) {
+    size_t total_pids = length_pid_queue(&job->process_ids);
+
+    for (size_t p = 0; p < total_pids; p++) {
+        pid_t pid = peek_at_pid_queue(&job->process_ids, p);
+        int status;
+        struct rusage rusage;
+
+        if (find_job_by_pid(pid) != job)
+            continue; // Reaped already
+
+        if (wait4(pid, &status, WUNTRACED, &rusage) != pid)
+            memset(&rusage, 0, sizeof(rusage)); // Not ours to wait for, count it as gone
+        else if (WIFSTOPPED(status)) {
+            set_job_stopped(job, true);
+            print_job_stopped(job->job_id, job->first_pid, job->command);
+            return false;
+        }
+
+        if (job_process_exited(pid, &rusage) != NULL)
+            return true;
+    }
+
+    return false;
+}
+
+// True if some started job is neither stopped nor pending
+static bool any_job_running() {
+    for (Job* job = first_job(); job != NULL; job = next_job(job)) {
+        if (!job->pending && !job->stopped)
+            return true;
+    }
+
+    return false;
+}
+
+// Waits for a job to complete or stop, first for a slot if it is pending.
+// Returns false if it cannot finish because every running job is stopped.
+static bool wait_job_done(int job_id) {
+    Job* job;
+
+    while ((job = find_job(job_id)) != NULL && !job->stopped) {
+        if (job->pending) {
+            if (defer_pending_jobs) {
+                fprintf(stderr, "wait: job %d cannot start until this line is running\n", job_id);
+                return false;
+            }
+
+            if (!any_job_running()) {
+                fprintf(stderr, "wait: job %d cannot start while the others are stopped\n", job_id);
+                return false;
             }
+
+            reap_children(true); // Starts it once a slot frees up
+            continue;
         }
-        push_back_job_queue(&job_list, current_job); // Add job back to list
+
+        if (wait_job(job))
+            complete_job(job, true);
+        start_pending_jobs(); // In the slot it freed by completing or stopping
+    }
+
+    return true;
+}
+
+// Moves a job to the foreground, continuing it if it was stopped, and waits
+// for it like a foreground line
+void run_fg(FgCommand cmd) {
+    Job* job = find_job_arg("fg", cmd.args);
+
+    if (job == NULL)
+        return;
+
+    if (job->pending) {
+        fprintf(stderr, "fg: job %d has not started yet\n", job->job_id);
+        return;
+    }
+
+    printf("%s\n", job->command);
+    fflush(stdout);
+
+    give_terminal(job->pgid);
+
+    if (job->stopped) {
+        set_job_stopped(job, false);
+        signal_job(job, SIGCONT);
+    }
+
+    bool done = wait_job(job);
+
+    take_terminal();
+
+    if (done)
+        complete_job(job, false);
+    start_pending_jobs(); // In the slot it freed by completing or stopping
+}
+
+// Continues a stopped job in the background
+void run_bg(BgCommand cmd) {
+    Job* job = find_job_arg("bg", cmd.args);
+
+    if (job == NULL)
+        return;
+
+    if (!job->stopped) {
+        fprintf(stderr, "bg: job %d is already running\n", job->job_id);
+        return;
+    }
+
+    set_job_stopped(job, false);
+    signal_job(job, SIGCONT);
+    print_job(job->job_id, job->first_pid, job->command);
+}
+
+// Waits for the jobs given as %N or N, or for every job that is not stopped
+void run_wait(WaitCommand cmd) {
+    char** args = cmd.args;
+
+    if (*args == NULL) {
+        for (Job* job = first_job(); job != NULL; job = next_job(job)) {
+            if (!job->stopped && !wait_job_done(job->job_id))
+                return;
+        }
+        return;
+    }
+
+    // A job that is gone has already been reaped and reported
+    for (int job_id; *args != NULL; ++args) {
+        if (parse_job_spec("wait", *args, &job_id) && !wait_job_done(job_id))
+            return;
     }
 }
 
@@ -208,17 +687,71 @@ void run_pwd() {
     fflush(stdout); // Flush the buffer before returning
 }
 
-// Prints all background jobs currently in the job list to stdout
-void run_jobs() {
-    int total_jobs = length_job_queue(&job_list);
-    for (int j = 0; j < total_jobs; j++) {
-        struct Job current_job = pop_front_job_queue(&job_list);
-        print_job(current_job.job_id, current_job.first_pid, current_job.command); // Print job details
-        push_back_job_queue(&job_list, current_job); // Add job back to list
+// Prints all background jobs currently in the job list to stdout. With -l the
+// resources used so far are shown too. CPU time and RSS only cover the
+// stages that have already exited.
+void run_jobs(JobsCommand cmd) {
+    bool long_format = false;
+
+    for (char** args = cmd.args; *args != NULL; ++args) {
+        if (strcmp(*args, "-l") == 0)
+            long_format = true;
+        else
+            fprintf(stderr, "jobs: %s: invalid option\n", *args);
     }
+
+    for (Job* job = first_job(); job != NULL; job = next_job(job)) {
+        if (job->pending)
+            printf("[%d]\t%8s\t%s\n", job->job_id, "pending", job->command);
+        else if (long_format)
+            print_job_usage(job);
+        else if (job->stopped)
+            printf("[%d]\t%8d\t%s (stopped)\n", job->job_id, job->first_pid, job->command);
+        else
+            print_job(job->job_id, job->first_pid, job->command); // Print job details
+    }
+    fflush(stdout); // Flush the buffer before returning
+}
+
+// Prints the user and system time used by quash and by its reaped children
+void run_times() {
+    struct rusage self;
+    struct rusage children;
+
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    print_duration(stdout, timeval_seconds(self.ru_utime));
+    putchar(' ');
+    print_duration(stdout, timeval_seconds(self.ru_stime));
+    putchar('\n');
+    print_duration(stdout, timeval_seconds(children.ru_utime));
+    putchar(' ');
+    print_duration(stdout, timeval_seconds(children.ru_stime));
+    putchar('\n');
     fflush(stdout); // Flush the buffer before returning
 }
 
+// Lists, fills or clears the cache of executable locations
+void run_hash(HashCommand cmd) {
+    char** args = cmd.args;
+
+    if (*args == NULL) {
+        path_cache_print(); // No arguments lists the table
+        return;
+    }
+
+    for (; *args != NULL; ++args) {
+        if (strcmp(*args, "-r") == 0) {
+            path_cache_clear(); // Forget every remembered location
+        } else if (strcmp(*args, "-s") == 0) {
+            path_cache_print_stats(); // Print hit and miss counters
+        } else if (!path_cache_insert(*args)) {
+            fprintf(stderr, "hash: %s: not found\n", *args);
+        }
+    }
+}
+
 /***************************************************************************
  * Functions for command resolution and process setup
  ***************************************************************************/
@@ -227,10 +760,6 @@ void child_run_command(Command cmd) {
     CommandType type = get_command_type(cmd); // Get command type
 
     switch (type) {
-        case GENERIC:
-            run_generic(cmd.generic);
-            break;
-
         case ECHO:
             run_echo(cmd.echo);
             break;
@@ -240,12 +769,25 @@ void child_run_command(Command cmd) {
             break;
 
         case JOBS:
-            run_jobs();
+            run_jobs(cmd.jobs);
+            break;
+
+        case TIMES:
+            run_times();
             break;
 
+        case PARALLEL:
+            run_parallel(cmd.parallel);
+            break;
+
+        case GENERIC: // Started by launch_generic, never from a forked copy of quash
         case EXPORT:
         case CD:
         case KILL:
+        case HASH:
+        case FG:
+        case BG:
+        case WAIT:
         case EXIT:
         case EOC:
             break;
@@ -272,10 +814,28 @@ void parent_run_command(Command cmd) {
             run_kill(cmd.kill);
             break;
 
+        case HASH:
+            run_hash(cmd.hash);
+            break;
+
+        case FG:
+            run_fg(cmd.fg);
+            break;
+
+        case BG:
+            run_bg(cmd.bg);
+            break;
+
+        case WAIT:
+            run_wait(cmd.wait);
+            break;
+
         case GENERIC:
         case ECHO:
         case PWD:
         case JOBS:
+        case TIMES:
+        case PARALLEL:
         case EXIT:
         case EOC:
             break;
@@ -285,6 +845,301 @@ void parent_run_command(Command cmd) {
     }
 }
 
+// Starts an external program at the path resolve_program found for it
+// through the configured launch engine
+static pid_t launch_generic(CommandHolder holder, const char* path, int in_fd, int out_fd) {
+    char** args = holder.cmd.generic.args;
+
+    if (path == NULL)
+        return -1; // Not found, already reported
+
+    LaunchFds fds = mk_launch_fds(in_fd, out_fd,
+                                  (holder.flags & REDIRECT_IN) ? holder.redirect_in : NULL,
+                                  (holder.flags & REDIRECT_OUT) ? holder.redirect_out : NULL,
+                                  holder.flags & REDIRECT_APPEND);
+
+    fds.pgid = line_pgid;
+    fds.terminal = line_terminal;
+
+    uint64_t start = trace_begin();
+    pid_t pid = launch_program(launch_engine, path, args, var_store_envp(), &fds);
+
+    trace_end("launch", start, pid > 0 ? pid : 0, args[0]); // Covers the exec for spawn and vfork
+
+    return pid;
+}
+
+// Points fd at file and returns a close-on-exec copy of the old descriptor
+static int redirect_fd(int fd, const char* file, int flags) {
+    int file_fd = open(file, flags, 0666);
+
+    if (file_fd < 0) {
+        perror("ERROR: Failed to open redirect");
+        return -1;
+    }
+
+    int saved = fcntl(fd, F_DUPFD_CLOEXEC, 10); // Keep it clear of 0-2
+    dup2(file_fd, fd);
+    close(file_fd);
+
+    return saved;
+}
+
+// Puts back a descriptor saved by redirect_fd
+static void restore_fd(int fd, int saved) {
+    if (saved >= 0) {
+        dup2(saved, fd);
+        close(saved);
+    }
+}
+
+// Runs a builtin inside quash instead of a child, redirecting its standard
+// streams only for the duration of the command. fast is the parsed call
+// when the command is a program quash stands in for, NULL otherwise.
+static void run_builtin_in_process(CommandHolder holder, const FastBuiltin* fast) {
+    int saved_in = -1;
+    int saved_out = -1;
+
+    if (holder.flags & REDIRECT_IN) {
+        if ((saved_in = redirect_fd(STDIN_FILENO, holder.redirect_in, O_RDONLY)) < 0)
+            return;
+    }
+
+    if (holder.flags & REDIRECT_OUT) {
+        int flags = O_WRONLY | O_CREAT | ((holder.flags & REDIRECT_APPEND) ? O_APPEND : O_TRUNC);
+
+        fflush(stdout); // Earlier output belongs to the old stdout
+        if ((saved_out = redirect_fd(STDOUT_FILENO, holder.redirect_out, flags)) < 0) {
+            restore_fd(STDIN_FILENO, saved_in);
+            return;
+        }
+    }
+
+    // A reader that goes away must stop the command, not quash. Programs
+    // the builtin starts get the default action back in the launch engines.
+    struct sigaction ignore;
+    struct sigaction saved_pipe;
+
+    ignore.sa_handler = SIG_IGN;
+    ignore.sa_flags = 0;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGPIPE, &ignore, &saved_pipe);
+
+    if (fast != NULL) {
+        fast_builtin_run(fast);
+    } else {
+        child_run_command(holder.cmd); // Builtins normally run in a child
+        parent_run_command(holder.cmd); // Builtins that always run in quash
+    }
+
+    fflush(stdout);
+    sigaction(SIGPIPE, &saved_pipe, NULL);
+    restore_fd(STDOUT_FILENO, saved_out);
+    restore_fd(STDIN_FILENO, saved_in);
+}
+
+// Checks if quash can become the command instead of forking it: the last
+// line of a script or -c string, holding one foreground program, with no
+// background job left to look after
+static bool can_exec_in_place(CommandHolder* holders) {
+    return is_batch() && !is_running() &&
+           get_command_holder_type(holders[0]) == GENERIC &&
+           get_command_holder_type(holders[1]) == EOC &&
+           !(holders[0].flags & (BACKGROUND | TIMED)) &&
+           first_job() == NULL;
+}
+
+// Replaces quash with the command. Does not return.
+static void exec_in_place(CommandHolder holder) {
+    if (holder.flags & REDIRECT_IN) {
+        if (redirect_fd(STDIN_FILENO, holder.redirect_in, O_RDONLY) < 0)
+            exit(EXIT_FAILURE);
+    }
+
+    if (holder.flags & REDIRECT_OUT) {
+        int flags = O_WRONLY | O_CREAT | ((holder.flags & REDIRECT_APPEND) ? O_APPEND : O_TRUNC);
+
+        fflush(stdout); // Earlier output belongs to the old stdout
+        if (redirect_fd(STDOUT_FILENO, holder.redirect_out, flags) < 0)
+            exit(EXIT_FAILURE);
+    }
+
+    const char* path = resolve_program(holder.cmd.generic.args[0]);
+    FastBuiltin fast;
+
+    if (path == NULL)
+        exit(EXIT_FAILURE);
+
+    if (can_stand_in(holder.cmd.generic.args, path, &fast)) {
+        signal(SIGPIPE, SIG_IGN); // A closed reader ends it with 141, quietly
+        exit(fast_builtin_run(&fast)); // Nothing to exec
+    }
+
+    fflush(stdout); // exec discards anything still buffered
+    trace_instant("exec in place", 0, holder.cmd.generic.args[0]);
+    trace_close(); // exec discards the trace buffer too
+    run_generic(holder.cmd.generic, path);
+}
+
+// Makes sure a pipeline needing `needed` more descriptors fits under RLIMIT_NOFILE
+static void reserve_fds(int needed) {
+    struct rlimit lim;
+    rlim_t want = (rlim_t) needed + 64; // Room for redirects and the shell itself
+
+    if (getrlimit(RLIMIT_NOFILE, &lim) != 0 || lim.rlim_cur >= want)
+        return;
+
+    lim.rlim_cur = (lim.rlim_max == RLIM_INFINITY || lim.rlim_max > want) ? want : lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+}
+
+// Closes one pipe end if it is still open
+static void close_pipe_end(int* fd) {
+    if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+// Closes every pipe end still held by quash and drops the plan
+static void destroy_pipe_plan() {
+    for (int i = 0; i < pipe_plan.created; ++i) {
+        close_pipe_end(&pipe_plan.fds[i][READ_END]);
+        close_pipe_end(&pipe_plan.fds[i][WRITE_END]);
+    }
+
+    free(pipe_plan.fds);
+    pipe_plan = (PipePlan) { NULL, 0, 0, 0 };
+}
+
+// Largest capacity an unprivileged process may give a pipe
+static long get_pipe_max_size() {
+    if (pipe_max_size < 0) {
+        FILE* f = fopen("/proc/sys/fs/pipe-max-size", "re");
+
+        pipe_max_size = 0;
+
+        if (f != NULL) {
+            if (fscanf(f, "%ld", &pipe_max_size) != 1)
+                pipe_max_size = 0;
+            fclose(f);
+        }
+    }
+
+    return pipe_max_size;
+}
+
+// Pipe capacity asked for by $QUASH_PIPEBUF, such as 65536, 256K or 1M, capped
+// by pipe-max-size and by what F_SETPIPE_SZ takes. Returns 0 to keep the
+// kernel default.
+static long pipe_buffer_size() {
+    const char* setting = lookup_env("QUASH_PIPEBUF");
+    long size;
+
+    if (setting == NULL || *setting == '\0')
+        return 0;
+
+    if (!parse_size(setting, &size)) {
+        fprintf(stderr, "WARNING: Ignoring invalid QUASH_PIPEBUF \"%s\"\n", setting);
+        return 0;
+    }
+
+    long max = get_pipe_max_size();
+
+    if (max > 0 && size > max)
+        size = max;
+
+    return size > INT_MAX ? INT_MAX : size;
+}
+
+// Makes the pipes up to and including pipe i. Returns false if it fails.
+static bool create_pipes_until(int i) {
+    for (; pipe_plan.created <= i; ++pipe_plan.created) {
+        if (pipe2(pipe_plan.fds[pipe_plan.created], O_CLOEXEC) < 0)
+            return false;
+
+        // Best effort, the kernel may refuse once the user's pipe pages run out
+        if (pipe_plan.buffer_size > 0 &&
+            fcntl(pipe_plan.fds[pipe_plan.created][WRITE_END], F_SETPIPE_SZ,
+                  (int) pipe_plan.buffer_size) < 0 && !pipe_size_warned) {
+            perror("WARNING: Failed to resize pipe to QUASH_PIPEBUF");
+            pipe_size_warned = true;
+        }
+    }
+
+    return true;
+}
+
+// Creates the pipes joining `stages` commands. All of them are close-on-exec,
+// so a stage only keeps the two ends installed as its stdin and stdout. If the
+// descriptor limit cannot hold them all, the rest are made as stages start.
+static bool create_pipe_plan(int stages) {
+    if (stages < 2)
+        return true;
+
+    uint64_t start = trace_begin();
+
+    reserve_fds(2 * (stages - 1));
+
+    pipe_plan.fds = malloc((stages - 1) * sizeof(*pipe_plan.fds));
+
+    if (pipe_plan.fds == NULL) {
+        fprintf(stderr, "ERROR: Failed to allocate the pipeline\n");
+        return false;
+    }
+
+    pipe_plan.count = stages - 1;
+    pipe_plan.buffer_size = pipe_buffer_size();
+
+    if (!create_pipes_until(pipe_plan.count - 1) && pipe_plan.created == 0) {
+        perror("ERROR: Failed to create pipe");
+        destroy_pipe_plan();
+        return false;
+    }
+
+    trace_end("pipeline setup", start, 0, NULL);
+
+    return true;
+}
+
+// Puts a stage of the current line in the line's group, the first stage
+// leading it. The child joins on its own too, so whichever runs first wins
+// and the group exists before the next stage is started. Once the child has
+// exec'd the call fails harmlessly.
+static void join_line_group(pid_t pid) {
+    if (pid <= 0 || line_pgid < 0)
+        return;
+
+    if (line_pgid == 0) {
+        line_pgid = pid;
+        setpgid(pid, pid);
+        if (line_terminal)
+            give_terminal(pid);
+        return;
+    }
+
+    setpgid(pid, line_pgid);
+}
+
+// Child side of join_line_group for stages quash forks itself
+static void join_line_group_in_child() {
+    if (line_pgid < 0)
+        return;
+
+    setpgid(0, line_pgid);
+    if (line_terminal)
+        give_terminal(getpgrp());
+
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+}
+
+// Releases the pid queue shared by every command line
+static void destroy_process_id_queue() {
+    destroy_pid_queue(&process_id_queue);
+}
+
 // Creates a new process for the given command in the CommandHolder, setting up redirects and pipes
 void create_process(CommandHolder holder, int index) {
     // Read flags from the parser
@@ -294,25 +1149,79 @@ void create_process(CommandHolder holder, int index) {
     bool redirect_out = holder.flags & REDIRECT_OUT;
     bool redirect_append = holder.flags & REDIRECT_APPEND;
 
-    int write_end = index % 2; // Determine write end for pipe
-    int read_end = (index - 1) % 2; // Determine read end for pipe
+    if (pipe_in && index > pipe_plan.created)
+        pipe_in = false; // The previous stage could not get its pipe either
 
-    if (pipe_out) {
-        pipe(pipes[write_end]); // Create pipe for output
+    if (pipe_out && !create_pipes_until(index)) {
+        perror("ERROR: Failed to create pipe");
+        pipe_out = false; // Let the stage write to quash's stdout instead
     }
+
+    // Ends this stage reads from and writes to, taken from the plan
+    int* in_fd = pipe_in ? &pipe_plan.fds[index - 1][READ_END] : NULL;
+    int* out_fd = pipe_out ? &pipe_plan.fds[index][WRITE_END] : NULL;
+
+    // External programs are found once, here. A program quash stands in for
+    // then runs like a builtin.
+    const char* path = NULL;
+    FastBuiltin fast_call;
+    FastBuiltin* fast = NULL;
+
+    if (get_command_type(holder.cmd) == GENERIC &&
+        (path = resolve_program(holder.cmd.generic.args[0])) != NULL &&
+        can_stand_in(holder.cmd.generic.args, path, &fast_call))
+        fast = &fast_call;
+
+    // A foreground builtin outside of a pipeline does not need a process.
+    // Under job control a stand-in is forked all the same, so that it gets the
+    // terminal and ^C and ^Z reach it rather than quash.
+    if ((get_command_type(holder.cmd) != GENERIC || (fast != NULL && !job_control)) &&
+        !fork_builtins && !pipe_in && !pipe_out && !(holder.flags & BACKGROUND)) {
+        uint64_t start = trace_begin();
+
+        run_builtin_in_process(holder, fast);
+        trace_end("builtin", start, 0, fast != NULL ? holder.cmd.generic.args[0] : NULL);
+        return;
+    }
+
+    // External programs skip the generic fork path below
+    if (get_command_type(holder.cmd) == GENERIC && fast == NULL) {
+        pid_t pid = launch_generic(holder, path,
+                                   pipe_in ? *in_fd : -1,
+                                   pipe_out ? *out_fd : -1);
+
+        if (pid > 0)
+            push_back_pid_queue(&process_id_queue, pid); // Add PID to queue
+        join_line_group(pid);
+
+        // The stage owns its ends now, only it may keep them open
+        if (pipe_in)
+            close_pipe_end(in_fd);
+        if (pipe_out)
+            close_pipe_end(out_fd);
+
+        return;
+    }
+
+    uint64_t start = trace_begin();
     pid_t pid = fork(); // Create new process
 
     push_back_pid_queue(&process_id_queue, pid); // Add PID to queue
+    if (pid > 0)
+        trace_end("fork", start, pid, NULL);
     if (pid == 0) {
         // Child process
+        join_line_group_in_child();
+        signal(SIGPIPE, SIG_DFL); // Ignored while quash runs a builtin that forks this
+
         if (pipe_in) {
-            dup2(pipes[read_end][READ_END], STDIN_FILENO); // Redirect input from pipe
-            close(pipes[read_end][READ_END]);
+            dup2(*in_fd, STDIN_FILENO); // Redirect input from pipe
         }
         if (pipe_out) {
-            dup2(pipes[write_end][WRITE_END], STDOUT_FILENO); // Redirect output to pipe
-            close(pipes[write_end][WRITE_END]);
+            dup2(*out_fd, STDOUT_FILENO); // Redirect output to pipe
         }
+        destroy_pipe_plan(); // A builtin never execs, so drop the other stages' ends by hand
+
         if (redirect_in) {
             FILE* f = fopen(holder.redirect_in, "r"); // Open input redirection file
             dup2(fileno(f), STDIN_FILENO); // Redirect input
@@ -322,26 +1231,191 @@ void create_process(CommandHolder holder, int index) {
             dup2(fileno(f), STDOUT_FILENO); // Redirect output
         }
 
-        child_run_command(holder.cmd); // Execute command
-        exit(0); // Exit child process
-    } else if (pipe_out) {
-        close(pipes[write_end][WRITE_END]); // Close write end of pipe in parent
+        int status = EXIT_SUCCESS;
+
+        if (fast != NULL)
+            status = fast_builtin_run(fast);
+        else
+            child_run_command(holder.cmd); // Execute command
+
+        fflush(stdout);
+        _exit(status); // Skip exit() so stdio does not rewind the shared stdin offset
     }
 
+    join_line_group(pid);
+
+    if (pipe_in)
+        close_pipe_end(in_fd); // Close the stage's ends in the parent
+    if (pipe_out)
+        close_pipe_end(out_fd);
+
+    // fg and wait may free job slots here, before the line's other stages
+    // have started
+    bool deferred = defer_pending_jobs;
+
+    defer_pending_jobs = true;
     parent_run_command(holder.cmd); // Execute command in parent process
+    defer_pending_jobs = deferred;
+}
+
+pid_t start_background_command(CommandHolder holder) {
+    holder.flags = (holder.flags & ~(PIPE_IN | PIPE_OUT)) | BACKGROUND; // Never in process
+
+    size_t queued = length_pid_queue(&process_id_queue);
+    pid_t saved_pgid = line_pgid;
+    bool saved_terminal = line_terminal;
+
+    // Not a job of its own, so it stays in the caller's group
+    line_pgid = -1;
+    line_terminal = false;
+    create_process(holder, 0);
+    line_pgid = saved_pgid;
+    line_terminal = saved_terminal;
+
+    if (length_pid_queue(&process_id_queue) == queued)
+        return -1;
+
+    return pop_back_pid_queue(&process_id_queue); // The caller waits for it
+}
+
+// Starts every stage of a line, leaving their pids in process_id_queue and
+// their process group in line_pgid. Background lines get a group of their
+// own, and so do foreground lines under job control, which also take the
+// terminal. Returns false if the pipes could not be set up.
+static bool launch_line(CommandHolder* holders) {
+    int stages = 0;
+    bool background = holders[0].flags & BACKGROUND;
+
+    line_pgid = (background || job_control) ? 0 : -1;
+    line_terminal = job_control && !background;
+
+    while (get_command_holder_type(holders[stages]) != EOC)
+        ++stages;
+
+    if (!create_pipe_plan(stages))
+        return false;
+
+    // Run all commands in the `holders` array
+    for (int i = 0; i < stages; ++i) {
+        create_process(holders[i], i); // Create a new process for each command
+    }
+
+    destroy_pipe_plan(); // Every end should already be closed
+
+    return true;
+}
+
+// Background jobs allowed to run at once, from $QUASH_MAXJOBS. Defaults to the
+// number of online CPUs, and 0 removes the limit.
+static long max_jobs() {
+    const char* setting = lookup_env("QUASH_MAXJOBS");
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    char* end;
+
+    if (setting == NULL || *setting == '\0')
+        return cpus > 0 ? cpus : 1;
+
+    long limit = strtol(setting, &end, 10);
+
+    if (limit < 0 || *end != '\0') {
+        fprintf(stderr, "WARNING: Ignoring invalid QUASH_MAXJOBS \"%s\"\n", setting);
+        return cpus > 0 ? cpus : 1;
+    }
+
+    return limit;
+}
+
+static bool job_slot_free() {
+    return job_limit == 0 || running_jobs < job_limit;
+}
+
+// Starts pending jobs in order while there are free slots. Does nothing
+// while the current line is still being launched, since a pending job
+// would take over its pipes, process group and pids. run_script starts them
+// once the line is running.
+static void start_pending_jobs() {
+    if (defer_pending_jobs)
+        return;
+
+    while (!is_empty_pending_queue(&pending_jobs) && job_slot_free()) {
+        PendingJob pending = pop_front_pending_queue(&pending_jobs);
+        Job* job = find_job(pending.job_id);
+        JobUsage usage = mk_job_usage();
+
+        empty_pid_queue(&process_id_queue);
+
+        if (launch_line(pending.script) && !is_empty_pid_queue(&process_id_queue)) {
+            job_started(job, &process_id_queue);
+            job->pgid = line_pgid;
+            job->usage = usage;
+            ++running_jobs;
+            watch_job(job);
+            print_job_bg_start(job->job_id, job->first_pid, job->command);
+        } else {
+            remove_job(job); // Nothing could be started
+        }
+
+        free(pending.script);
+        empty_pid_queue(&process_id_queue);
+    }
+}
+
+// Queues a background line until a job slot frees up
+static void queue_job(CommandHolder* holders) {
+    Job* job = add_job(get_command_string(), &process_id_queue); // No pids, so pending
+
+    job->timed = holders[0].flags & TIMED;
+    push_back_pending_queue(&pending_jobs, (PendingJob) { job->job_id, copy_command_holders(holders) });
+    print_job_bg_pending(job->job_id, job->command);
+}
+
+// Drops a pending job from the queue and the job table
+static void cancel_pending_job(Job* job) {
+    size_t count = length_pending_queue(&pending_jobs);
+
+    // Rotate the queue once, leaving the cancelled job out
+    for (size_t i = 0; i < count; ++i) {
+        PendingJob pending = pop_front_pending_queue(&pending_jobs);
+
+        if (pending.job_id == job->job_id)
+            free(pending.script);
+        else
+            push_back_pending_queue(&pending_jobs, pending);
+    }
+
+    remove_job(job);
+}
+
+// Releases the scripts of jobs that never started
+static void destroy_pending_jobs() {
+    while (!is_empty_pending_queue(&pending_jobs))
+        free(pop_front_pending_queue(&pending_jobs).script);
+
+    destroy_pending_queue(&pending_jobs);
 }
 
 // Run a list of commands
 void run_script(CommandHolder* holders) {
     if (!is_initialized) {
-        job_list = new_job_queue(1); // Initialize job queue
+        launch_engine = default_launch_engine(); // Pick spawn, vfork or fork
+        fork_builtins = getenv("QUASH_FORK_BUILTINS") != NULL; // Old behaviour, for comparison
+        fast_builtins = getenv("QUASH_FAST_BUILTINS") == NULL ||
+            strcmp(getenv("QUASH_FAST_BUILTINS"), "0") != 0;
+        install_sigchld_handler(); // Reap background jobs as they exit
+        init_job_control(); // Give foreground lines the terminal if interactive
+        process_id_queue = new_pid_queue(1); // Initialize process ID queue
+        atexit(destroy_process_id_queue);
+        pending_jobs = new_pending_queue(1);
+        atexit(destroy_pending_jobs);
         is_initialized = true; // Set initialization flag
     }
-    process_id_queue = new_pid_queue(1); // Initialize process ID queue
+    empty_pid_queue(&process_id_queue); // Forget the previous line's processes
 
     if (holders == NULL)
         return; // Return if no commands to run
 
+    job_limit = max_jobs(); // Once per line, every reap and start checks it
+
     check_jobs_bg_status(); // Check background jobs status
 
     // Check if the first command is EXIT and the second is EOC
@@ -351,28 +1425,69 @@ void run_script(CommandHolder* holders) {
         return;
     }
 
-    CommandType type;
+    if (can_exec_in_place(holders))
+        exec_in_place(holders[0]); // Saves a fork for the final command
 
-    // Run all commands in the `holders` array
-    for (int i = 0; (type = get_command_holder_type(holders[i])) != EOC; ++i) {
-        create_process(holders[i], i); // Create a new process for each command
+    // Background lines wait their turn once the job limit is reached
+    if ((holders[0].flags & BACKGROUND) &&
+        (!is_empty_pending_queue(&pending_jobs) || !job_slot_free())) {
+        queue_job(holders);
+        return;
+    }
+
+    JobUsage usage = mk_job_usage(); // Accounts for every stage of the line
+
+    if (!launch_line(holders)) {
+        start_pending_jobs(); // Any that fg or wait freed a slot for
+        return;
     }
 
     // If the job is not a background job, wait for all child processes to finish
     if (!(holders[0].flags & BACKGROUND)) {
         while (!is_empty_pid_queue(&process_id_queue)) {
-            pid_t curr_pid = pop_front_pid_queue(&process_id_queue);
+            pid_t curr_pid = peek_front_pid_queue(&process_id_queue);
             int status;
-            waitpid(curr_pid, &status, 0); // Wait for child to finish
+            struct rusage rusage;
+            uint64_t start = trace_begin();
+            pid_t waited = wait4(curr_pid, &status, WUNTRACED, &rusage); // Wait for child to finish
+            trace_end("wait", start, curr_pid, NULL);
+
+            if (waited == curr_pid && WIFSTOPPED(status))
+                break; // The rest of the line becomes a stopped job below
+
+            pop_front_pid_queue(&process_id_queue);
+            if (waited == curr_pid)
+                add_job_usage(&usage, &rusage);
+        }
+
+        take_terminal();
+
+        if (is_empty_pid_queue(&process_id_queue)) {
+            finish_job_usage(&usage);
+            if (holders[0].flags & TIMED)
+                print_time_report(&usage);
+            start_pending_jobs(); // Any that fg or wait freed a slot for
+            return;
         }
-        destroy_pid_queue(&process_id_queue); // Clean up PID queue
-    } else { // If it's a background job
-        struct Job current_job;
-        current_job.job_id = job_count++;
-        current_job.process_ids = process_id_queue;
-        current_job.command = get_command_string();
-        current_job.first_pid = peek_back_pid_queue(&process_id_queue); // First PID of the job
-        push_back_job_queue(&job_list, current_job); // Add job to the job list
-        print_job_bg_start(current_job.job_id, current_job.first_pid, current_job.command); // Print start message
+
+        // A stage was stopped, such as by ^Z, so keep what is left as a job
+        Job* job = add_job(get_command_string(), &process_id_queue);
+        job->pgid = line_pgid > 0 ? line_pgid : 0;
+        job->usage = usage;
+        job->stopped = true; // Never counted as running
+        job->timed = holders[0].flags & TIMED;
+        watch_job(job);
+        print_job_stopped(job->job_id, job->first_pid, job->command);
+    } else if (!is_empty_pid_queue(&process_id_queue)) { // If it's a background job
+        Job* job = add_job(get_command_string(), &process_id_queue); // Copy into the job table
+        job->pgid = line_pgid;
+        job->usage = usage;
+        ++running_jobs;
+        job->timed = holders[0].flags & TIMED;
+        watch_job(job);
+        print_job_bg_start(job->job_id, job->first_pid, job->command); // Print start message
     }
+
+    // The line's pids are in the job table now, so pending jobs may reuse the queue
+    start_pending_jobs(); // Any that fg or wait freed a slot for
 }
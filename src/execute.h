@@ -6,24 +6,47 @@
 #include <unistd.h>
 
 #include "command.h"
+#include "jobs.h"
 
 const char* lookup_env(const char* env_var);
 
+const char* lookup_env_n(const char* env_var, size_t len);
+
 void write_env(const char* env_var, const char* val);
 
+// Reads a byte count with an optional K, M or G suffix, as the QUASH_*
+// size settings take
+bool parse_size(const char* str, long* size);
+
 char* get_current_directory(bool* should_free);
 
 void check_jobs_bg_status();
 
+// Reaps one process of a background job once the event loop sees it exit
+void reap_job_process(pid_t pid);
+
+// Starts the background jobs still waiting for a slot, reaping running jobs
+// until every one of them has started
+void finish_pending_jobs();
+
 void print_job(int job_id, pid_t pid, const char* cmd);
 
 void print_job_bg_start(int job_id, pid_t pid, const char* cmd);
 
 
+void print_job_bg_pending(int job_id, const char* cmd);
+
 void print_job_bg_complete(int job_id, pid_t pid, const char* cmd);
 
+void print_job_stopped(int job_id, pid_t pid, const char* cmd);
+
+void print_job_usage(const Job* job);
+
+void print_time_report(const JobUsage* usage);
+
 
-void run_generic(GenericCommand cmd);
+// Execs a program at the path quash resolved for it. Does not return.
+void run_generic(GenericCommand cmd, const char* path);
 
 
 void run_echo(EchoCommand cmd);
@@ -36,13 +59,30 @@ void run_cd(CDCommand cmd);
 
 void run_kill(KillCommand cmd);
 
+// Job control on top of each job's process group. Jobs are named %N or N.
+void run_fg(FgCommand cmd);
+
+void run_bg(BgCommand cmd);
+
+void run_wait(WaitCommand cmd);
+
 
 void run_pwd();
 
 
-void run_jobs();
+void run_jobs(JobsCommand cmd);
+
+
+void run_times();
+
+
+void run_hash(HashCommand cmd);
 
 
 void run_script(CommandHolder* holders);
 
+// Starts one command in its own process through create_process without
+// making it a job. Returns its pid, for the caller to wait on, or -1.
+pid_t start_background_command(CommandHolder holder);
+
 #endif
@@ -0,0 +1,693 @@
+/* fast_builtins.c
+ *
+ * In-process stand-ins for cat, head, wc and seq. Lines like `cat file | ...`
+ * or `wc -l < file` would otherwise pay a process launch and an exec of
+ * coreutils for a few microseconds of work. Only the options handled here
+ * are accepted; anything else makes fast_builtin_parse() decline so the
+ * real program runs. Output and error messages follow GNU coreutils.
+ *
+ * cat moves data inside the kernel where the two descriptors allow it:
+ * copy_file_range() between regular files, splice() when either side is a
+ * pipe and sendfile() from a regular file to anything else. wc -l counts
+ * newlines 64 bytes at a time with SSE2.
+ */
+
+#define _GNU_SOURCE // copy_file_range(), splice()
+
+#include "fast_builtins.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define BUFFER_SIZE (1 << 17)
+#define KERNEL_CHUNK (1 << 30) // Largest request handed to the copy calls
+#define MAX_DIGITS 18          // Keeps every count and seq value far from overflow
+
+// How __copy_fd moves data between two descriptors
+typedef enum CopyMethod {
+  COPY_RANGE,     // copy_file_range(), regular file to regular file
+  COPY_SPLICE,    // splice(), either side a pipe
+  COPY_SENDFILE,  // sendfile(), regular file to anything
+  COPY_READ_WRITE // Plain read() and write() through the buffer
+} CopyMethod;
+
+typedef enum CopyResult {
+  COPY_OK,
+  COPY_READ_FAILED,
+  COPY_WRITE_FAILED
+} CopyResult;
+
+static char buffer[BUFFER_SIZE]; // Shared by every builtin, none runs concurrently
+static char* stdin_operand[] = { "-", NULL };
+
+/**************************************************************************
+ * Argument parsing
+ **************************************************************************/
+// Parses a count of at most MAX_DIGITS decimal digits
+static bool __parse_count(const char* str, long long* count) {
+  size_t len = strlen(str);
+
+  if (len == 0 || len > MAX_DIGITS || strspn(str, "0123456789") != len)
+    return false;
+
+  *count = strtoll(str, NULL, 10);
+
+  return true;
+}
+
+// Parses an integer with an optional minus sign
+static bool __parse_integer(const char* str, long long* value) {
+  bool negative = str[0] == '-';
+
+  if (!__parse_count(str + negative, value))
+    return false;
+
+  if (negative)
+    *value = -*value;
+
+  return true;
+}
+
+// Checks the arguments after the first operand. GNU tools accept options
+// anywhere, so an option there is left for the real program to handle.
+static bool __only_operands(char** args) {
+  for (; *args != NULL; ++args) {
+    if ((*args)[0] == '-' && (*args)[1] != '\0')
+      return false;
+  }
+
+  return true;
+}
+
+// cat [-u] [file...]
+static bool __parse_cat(char** args, FastBuiltin* call) {
+  for (; *args != NULL; ++args) {
+    if (strcmp(*args, "--") == 0) {
+      ++args;
+      break;
+    }
+
+    if (strcmp(*args, "-u") != 0) {
+      if ((*args)[0] == '-' && (*args)[1] != '\0')
+        return false;
+
+      if (!__only_operands(args))
+        return false;
+
+      break;
+    }
+  }
+
+  call->files = *args != NULL ? args : stdin_operand;
+
+  return true;
+}
+
+// head [-n N | -N | -c N] [file...]
+static bool __parse_head(char** args, FastBuiltin* call) {
+  call->bytes = false;
+  call->count = 10;
+
+  for (; *args != NULL; ++args) {
+    const char* arg = *args;
+
+    if (strcmp(arg, "--") == 0) {
+      ++args;
+      break;
+    }
+
+    if (arg[0] != '-' || arg[1] == '\0') {
+      if (!__only_operands(args))
+        return false;
+
+      break;
+    }
+
+    if (arg[1] == 'n' || arg[1] == 'c') {
+      const char* count = arg[2] != '\0' ? arg + 2 : *++args;
+
+      call->bytes = arg[1] == 'c';
+
+      if (count == NULL || !__parse_count(count, &call->count))
+        return false;
+    }
+    else if (!__parse_count(arg + 1, &call->count)) {
+      return false;
+    }
+  }
+
+  call->files = *args != NULL ? args : stdin_operand;
+
+  return true;
+}
+
+// wc -l|-c [file]
+static bool __parse_wc(char** args, FastBuiltin* call) {
+  if (args[0] == NULL)
+    return false;
+
+  if (strcmp(args[0], "-l") == 0)
+    call->bytes = false;
+  else if (strcmp(args[0], "-c") == 0)
+    call->bytes = true;
+  else
+    return false;
+
+  ++args;
+
+  if (args[0] != NULL && strcmp(args[0], "--") == 0)
+    ++args;
+  else if (!__only_operands(args))
+    return false;
+
+  // Several files need the column widths of the real wc
+  if (args[0] != NULL && args[1] != NULL)
+    return false;
+
+  call->files = args;
+
+  return true;
+}
+
+// seq [first [step]] last, integers only
+static bool __parse_seq(char** args, FastBuiltin* call) {
+  long long values[3];
+  int n;
+
+  for (n = 0; args[n] != NULL; ++n) {
+    if (n == 3 || !__parse_integer(args[n], &values[n]))
+      return false;
+  }
+
+  call->first = 1;
+  call->step = 1;
+
+  switch (n) {
+  case 1:
+    call->last = values[0];
+    break;
+
+  case 2:
+    call->first = values[0];
+    call->last = values[1];
+    break;
+
+  case 3:
+    call->first = values[0];
+    call->step = values[1];
+    call->last = values[2];
+    break;
+
+  default:
+    return false;
+  }
+
+  return call->step != 0; // Left to seq, which reports it
+}
+
+bool fast_builtin_parse(char** args, FastBuiltin* call) {
+  const char* name = args[0];
+
+  if (strcmp(name, "cat") == 0) {
+    call->kind = FAST_CAT;
+    return __parse_cat(args + 1, call);
+  }
+
+  if (strcmp(name, "head") == 0) {
+    call->kind = FAST_HEAD;
+    return __parse_head(args + 1, call);
+  }
+
+  if (strcmp(name, "wc") == 0) {
+    call->kind = FAST_WC;
+    return __parse_wc(args + 1, call);
+  }
+
+  if (strcmp(name, "seq") == 0) {
+    call->kind = FAST_SEQ;
+    return __parse_seq(args + 1, call);
+  }
+
+  return false;
+}
+
+/**************************************************************************
+ * I/O helpers
+ **************************************************************************/
+static bool __write_all(int fd, const char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+
+      return false;
+    }
+
+    buf += n;
+    len -= n;
+  }
+
+  return true;
+}
+
+static ssize_t __read(int fd, char* buf, size_t len) {
+  ssize_t n;
+
+  while ((n = read(fd, buf, len)) < 0 && errno == EINTR)
+    ;
+
+  return n;
+}
+
+// Prints a write error and returns the exit status to give. A reader that
+// went away quietly stops the command with the status a shell shows for a
+// program killed by SIGPIPE, since quash ignores the signal while it runs
+// a stand-in itself.
+static int __write_error(const char* prog) {
+  if (errno == EPIPE)
+    return 128 + SIGPIPE;
+
+  fprintf(stderr, "%s: write error: %s\n", prog, strerror(errno));
+  return EXIT_FAILURE;
+}
+
+// Opens an operand, "-" being stdin. Prints the error with format and
+// returns -1 on failure.
+static int __open_input(const char* file, const char* format, const char* prog) {
+  if (strcmp(file, "-") == 0)
+    return STDIN_FILENO;
+
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+    fprintf(stderr, format, prog, file, strerror(errno));
+
+  return fd;
+}
+
+static void __close_input(int fd) {
+  if (fd != STDIN_FILENO)
+    close(fd);
+}
+
+static size_t __chunk(long long limit, size_t max) {
+  return (limit < 0 || (unsigned long long) limit > max) ? max : (size_t) limit;
+}
+
+// Picks the cheapest call that can move data from in to out. Pseudo files
+// such as those in /proc report a size of 0 and are read the plain way.
+static CopyMethod __copy_method(int in, int out) {
+  struct stat in_st;
+  struct stat out_st;
+
+  if (fstat(in, &in_st) != 0 || fstat(out, &out_st) != 0)
+    return COPY_READ_WRITE;
+
+  bool in_file = S_ISREG(in_st.st_mode) && in_st.st_size > 0;
+
+  if (in_file && S_ISREG(out_st.st_mode))
+    return COPY_RANGE;
+
+  if (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode))
+    return COPY_SPLICE;
+
+  if (in_file)
+    return COPY_SENDFILE;
+
+  return COPY_READ_WRITE;
+}
+
+static ssize_t __kernel_copy(CopyMethod method, int in, int out, size_t len) {
+  switch (method) {
+  case COPY_RANGE:
+    return copy_file_range(in, NULL, out, NULL, len, 0);
+
+  case COPY_SPLICE:
+    return splice(in, NULL, out, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+  case COPY_SENDFILE:
+    return sendfile(out, in, NULL, len);
+
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+}
+
+// Copies up to limit bytes, or everything when limit is negative. Each call
+// moves the file offsets, so a refused kernel copy carries on with read and
+// write from wherever it stopped.
+static CopyResult __copy_fd(int in, int out, long long limit) {
+  CopyMethod method = __copy_method(in, out);
+  ssize_t n;
+
+  while (method != COPY_READ_WRITE && limit != 0) {
+    n = __kernel_copy(method, in, out, __chunk(limit, KERNEL_CHUNK));
+
+    if (n == 0)
+      return COPY_OK;
+
+    if (n > 0) {
+      if (limit > 0)
+        limit -= n;
+      continue;
+    }
+
+    switch (errno) {
+    case EINTR:
+      continue;
+
+    case EINVAL:
+    case EBADF:
+    case EXDEV:
+    case ENOSYS:
+    case EOPNOTSUPP:
+      method = COPY_READ_WRITE; // This pair is not supported by the call
+      break;
+
+    case EPIPE:
+    case ENOSPC:
+    case EDQUOT:
+    case EFBIG:
+      return COPY_WRITE_FAILED;
+
+    default:
+      return COPY_READ_FAILED;
+    }
+  }
+
+  while (limit != 0) {
+    if ((n = __read(in, buffer, __chunk(limit, BUFFER_SIZE))) <= 0)
+      return n == 0 ? COPY_OK : COPY_READ_FAILED;
+
+    if (!__write_all(out, buffer, n))
+      return COPY_WRITE_FAILED;
+
+    if (limit > 0)
+      limit -= n;
+  }
+
+  return COPY_OK;
+}
+
+// Copies the first `lines` lines. A seekable input is left just past the
+// last line copied, as head does.
+static CopyResult __copy_lines(int in, int out, long long lines) {
+  while (lines > 0) {
+    ssize_t n = __read(in, buffer, BUFFER_SIZE);
+
+    if (n <= 0)
+      return n == 0 ? COPY_OK : COPY_READ_FAILED;
+
+    const char* end = buffer + n;
+    const char* pos = buffer;
+
+    while (lines > 0 && (pos = memchr(pos, '\n', end - pos)) != NULL) {
+      ++pos;
+      --lines;
+    }
+
+    size_t keep = lines == 0 ? (size_t) (pos - buffer) : (size_t) n;
+
+    if (!__write_all(out, buffer, keep))
+      return COPY_WRITE_FAILED;
+
+    if (keep < (size_t) n)
+      lseek(in, (off_t) keep - n, SEEK_CUR); // Fails harmlessly on pipes
+  }
+
+  return COPY_OK;
+}
+
+static size_t __count_newlines(const char* buf, size_t len) {
+  size_t count = 0;
+  size_t i = 0;
+
+#ifdef __SSE2__
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i zero = _mm_setzero_si128();
+
+  while (len - i >= 64) {
+    // A byte lane gains at most 4 per 64 bytes, so it stays below 256 for
+    // 63 rounds before being summed
+    size_t rounds = (len - i) / 64 > 63 ? 63 : (len - i) / 64;
+    __m128i lanes = zero;
+
+    for (; rounds > 0; --rounds, i += 64) {
+      const __m128i* p = (const __m128i*) (buf + i);
+      __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128(p), newline);
+      __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128(p + 1), newline);
+      __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128(p + 2), newline);
+      __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128(p + 3), newline);
+
+      // Matches are 0xff, so subtracting them counts up
+      lanes = _mm_sub_epi8(lanes, _mm_add_epi8(_mm_add_epi8(a, b), _mm_add_epi8(c, d)));
+    }
+
+    __m128i sums = _mm_sad_epu8(lanes, zero);
+
+    count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+  }
+#endif
+
+  const char* end = buf + len;
+
+  for (const char* pos = buf + i; (pos = memchr(pos, '\n', end - pos)) != NULL; ++pos)
+    ++count;
+
+  return count;
+}
+
+static bool __count_lines(int fd, long long* count) {
+  ssize_t n;
+
+  *count = 0;
+
+  while ((n = __read(fd, buffer, BUFFER_SIZE)) > 0)
+    *count += __count_newlines(buffer, n);
+
+  return n == 0;
+}
+
+// Regular files are measured without reading them
+static bool __count_bytes(int fd, long long* count) {
+  struct stat st;
+  ssize_t n;
+
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+
+    *count = pos >= 0 && pos < st.st_size ? st.st_size - pos : 0;
+
+    return true;
+  }
+
+  *count = 0;
+
+  while ((n = __read(fd, buffer, BUFFER_SIZE)) > 0)
+    *count += n;
+
+  return n == 0;
+}
+
+/**************************************************************************
+ * Builtins
+ **************************************************************************/
+// Checks if fd is the regular file stdout writes to, with data still to
+// read. Copying it would never reach the end of the file.
+static bool __is_output(int fd) {
+  struct stat in_st;
+  struct stat out_st;
+
+  if (fstat(fd, &in_st) != 0 || fstat(STDOUT_FILENO, &out_st) != 0)
+    return false;
+
+  return S_ISREG(out_st.st_mode) &&
+    in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino &&
+    lseek(fd, 0, SEEK_CUR) < in_st.st_size;
+}
+
+static int __run_cat(const FastBuiltin* call) {
+  int status = EXIT_SUCCESS;
+
+  for (char** file = call->files; *file != NULL; ++file) {
+    int fd = __open_input(*file, "%s: %s: %s\n", "cat");
+
+    if (fd < 0) {
+      status = EXIT_FAILURE;
+      continue;
+    }
+
+    if (__is_output(fd)) {
+      fprintf(stderr, "cat: %s: input file is output file\n", *file);
+      __close_input(fd);
+      status = EXIT_FAILURE;
+      continue;
+    }
+
+    CopyResult result = __copy_fd(fd, STDOUT_FILENO, -1);
+
+    __close_input(fd);
+
+    if (result == COPY_WRITE_FAILED)
+      return __write_error("cat");
+
+    if (result == COPY_READ_FAILED) {
+      fprintf(stderr, "cat: %s: %s\n", *file, strerror(errno));
+      status = EXIT_FAILURE;
+    }
+  }
+
+  return status;
+}
+
+static int __run_head(const FastBuiltin* call) {
+  bool headers = call->files[0] != NULL && call->files[1] != NULL;
+  int status = EXIT_SUCCESS;
+  int printed = 0;
+
+  for (char** file = call->files; *file != NULL; ++file) {
+    const char* name = strcmp(*file, "-") == 0 ? "standard input" : *file;
+    int fd = __open_input(*file, "%s: cannot open '%s' for reading: %s\n", "head");
+
+    if (fd < 0) {
+      status = EXIT_FAILURE;
+      continue;
+    }
+
+    if (headers) {
+      int len = snprintf(buffer, BUFFER_SIZE, "%s==> %s <==\n", printed++ ? "\n" : "", name);
+
+      if (!__write_all(STDOUT_FILENO, buffer, len)) {
+        __close_input(fd);
+        return __write_error("head");
+      }
+    }
+
+    CopyResult result = call->bytes ?
+      __copy_fd(fd, STDOUT_FILENO, call->count) :
+      __copy_lines(fd, STDOUT_FILENO, call->count);
+
+    __close_input(fd);
+
+    if (result == COPY_WRITE_FAILED)
+      return __write_error("head");
+
+    if (result == COPY_READ_FAILED) {
+      fprintf(stderr, "head: error reading '%s': %s\n", name, strerror(errno));
+      status = EXIT_FAILURE;
+    }
+  }
+
+  return status;
+}
+
+static int __run_wc(const FastBuiltin* call) {
+  const char* file = call->files[0]; // NULL for stdin, printed without a name
+  int status = EXIT_SUCCESS;
+  long long count;
+  int fd = STDIN_FILENO;
+
+  if (file != NULL && (fd = __open_input(file, "%s: %s: %s\n", "wc")) < 0)
+    return EXIT_FAILURE;
+
+  if (!(call->bytes ? __count_bytes(fd, &count) : __count_lines(fd, &count))) {
+    if (file == NULL || strcmp(file, "-") == 0)
+      fprintf(stderr, "wc: 'standard input': %s\n", strerror(errno));
+    else
+      fprintf(stderr, "wc: %s: %s\n", file, strerror(errno));
+
+    status = EXIT_FAILURE;
+  }
+
+  __close_input(fd);
+
+  int len = file != NULL ?
+    snprintf(buffer, BUFFER_SIZE, "%lld %s\n", count, file) :
+    snprintf(buffer, BUFFER_SIZE, "%lld\n", count);
+
+  if (!__write_all(STDOUT_FILENO, buffer, len))
+    return __write_error("wc");
+
+  return status;
+}
+
+// Writes value and a newline at the end of buf, returning the length used
+static size_t __format_line(char* buf, long long value) {
+  char digits[MAX_DIGITS + 3];
+  char* pos = digits + sizeof(digits);
+  unsigned long long magnitude = value < 0 ? -(unsigned long long) value : value;
+
+  *--pos = '\n';
+
+  do {
+    *--pos = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude > 0);
+
+  if (value < 0)
+    *--pos = '-';
+
+  size_t len = digits + sizeof(digits) - pos;
+
+  memcpy(buf, pos, len);
+
+  return len;
+}
+
+static int __run_seq(const FastBuiltin* call) {
+  size_t used = 0;
+
+  // Values stay within MAX_DIGITS digits, so value + step cannot overflow
+  for (long long value = call->first;
+       call->step > 0 ? value <= call->last : value >= call->last;
+       value += call->step) {
+    if (used > BUFFER_SIZE - (MAX_DIGITS + 3)) {
+      if (!__write_all(STDOUT_FILENO, buffer, used))
+        return __write_error("seq");
+
+      used = 0;
+    }
+
+    used += __format_line(buffer + used, value);
+  }
+
+  if (!__write_all(STDOUT_FILENO, buffer, used))
+    return __write_error("seq");
+
+  return EXIT_SUCCESS;
+}
+
+int fast_builtin_run(const FastBuiltin* call) {
+  fflush(stdout); // Output already buffered by other builtins comes first
+
+  switch (call->kind) {
+  case FAST_CAT:
+    return __run_cat(call);
+
+  case FAST_HEAD:
+    return __run_head(call);
+
+  case FAST_WC:
+    return __run_wc(call);
+
+  case FAST_SEQ:
+    return __run_seq(call);
+
+  default:
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,33 @@
+#ifndef SRC_FAST_BUILTINS_H
+#define SRC_FAST_BUILTINS_H
+
+#include <stdbool.h>
+
+// Programs quash can stand in for without starting a process
+typedef enum FastBuiltinKind {
+  FAST_CAT,
+  FAST_HEAD,
+  FAST_WC,
+  FAST_SEQ
+} FastBuiltinKind;
+
+// A call of a fast builtin whose arguments have been checked
+typedef struct FastBuiltin {
+  FastBuiltinKind kind;
+  char** files;     // Operands, NULL terminated. None reads stdin.
+  bool bytes;       // head -c and wc -c rather than lines
+  long long count;  // Lines or bytes kept by head
+  long long first;  // seq
+  long long step;   // seq
+  long long last;   // seq
+} FastBuiltin;
+
+// Fills call when args name cat, head, wc or seq with options quash
+// understands. Returns false when the real program has to run instead.
+bool fast_builtin_parse(char** args, FastBuiltin* call);
+
+// Runs a parsed call on the standard streams. Returns the exit status the
+// real program would have given.
+int fast_builtin_run(const FastBuiltin* call);
+
+#endif
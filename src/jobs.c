@@ -0,0 +1,398 @@
+/* jobs.c
+ *
+ * Bookkeeping for background jobs. Jobs live in a table of slots with freed
+ * slots kept on a free list. A pid index maps the pid returned by waitpid()
+ * straight to the slot of the job that owns it, and a job id index does the
+ * same for job ids, so finding, killing and completing a job never has to
+ * search the other jobs. Active slots are linked in job id order.
+ *
+ * Job ids keep increasing for the life of quash, independently of the slot a
+ * job lands in. A slot keeps its command buffer and pid array when its job is
+ * removed, and the next job in that slot reuses them. Memory stays bounded by
+ * the most jobs ever running at once rather than by the number of jobs started.
+ */
+
+#include "jobs.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+IMPLEMENT_DEQUE(pid_queue, pid_t);
+
+#define SLOT_INDEX_INIT_CAP 64
+#define JOB_TABLE_INIT_CAP 16
+
+typedef struct SlotEntry {
+  int key;  // Pid or job id, 0 marks an empty entry
+  int slot;
+} SlotEntry;
+
+// Open addressing map from a pid or job id to a job table slot
+typedef struct SlotIndex {
+  SlotEntry* entries;
+  size_t cap; // Always a power of two
+  size_t count;
+} SlotIndex;
+
+typedef struct JobTable {
+  Job* slots;
+  int cap;
+  int used;      // Slots handed out so far, the rest were never used
+  int ready;     // Slots whose command and pid storage has been set up
+  int count;     // Active jobs
+  int free_head; // First slot on the free list, or -1
+  int oldest;    // Active slot with the lowest job id, or -1
+  int newest;    // Active slot with the highest job id, or -1
+  int next_id;   // Job id the next job gets
+} JobTable;
+
+static SlotIndex pid_index = { NULL, 0, 0 };
+static SlotIndex id_index = { NULL, 0, 0 };
+static JobTable job_table = { NULL, 0, 0, 0, 0, -1, -1, -1, 1 };
+
+static inline size_t __hash_key(int key, size_t mask) {
+  // Fibonacci hashing spreads consecutive pids and ids across the table
+  return (size_t) (((uint64_t) key * 11400714819323198485ULL) >> 32) & mask;
+}
+
+static SlotEntry* __find_entry(SlotEntry* entries, size_t cap, int key) {
+  size_t mask = cap - 1;
+  size_t i = __hash_key(key, mask);
+
+  while (entries[i].key != 0 && entries[i].key != key)
+    i = (i + 1) & mask;
+
+  return &entries[i];
+}
+
+static void __grow(SlotIndex* index, size_t new_cap) {
+  SlotEntry* entries = calloc(new_cap, sizeof(SlotEntry));
+
+  if (entries == NULL) {
+    fprintf(stderr, "ERROR: Failed to allocate the job index\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < index->cap; ++i) {
+    if (index->entries[i].key != 0)
+      *__find_entry(entries, new_cap, index->entries[i].key) = index->entries[i];
+  }
+
+  free(index->entries);
+  index->entries = entries;
+  index->cap = new_cap;
+}
+
+/***************************************************************************
+ * Slot indexes
+ ***************************************************************************/
+static void slot_index_insert(SlotIndex* index, int key, int slot) {
+  // Keep the load factor at or below one half
+  if (2 * (index->count + 1) > index->cap)
+    __grow(index, index->cap == 0 ? SLOT_INDEX_INIT_CAP : 2 * index->cap);
+
+  SlotEntry* entry = __find_entry(index->entries, index->cap, key);
+
+  if (entry->key == 0)
+    ++index->count;
+
+  *entry = (SlotEntry) { key, slot };
+}
+
+static int slot_index_lookup(const SlotIndex* index, int key) {
+  if (index->count == 0)
+    return -1;
+
+  SlotEntry* entry = __find_entry(index->entries, index->cap, key);
+
+  return entry->key == 0 ? -1 : entry->slot;
+}
+
+// Returns the slot key mapped to, or -1 if key is unknown
+static int slot_index_remove(SlotIndex* index, int key) {
+  if (index->count == 0)
+    return -1;
+
+  size_t mask = index->cap - 1;
+  SlotEntry* entries = index->entries;
+  SlotEntry* entry = __find_entry(entries, index->cap, key);
+
+  if (entry->key == 0)
+    return -1;
+
+  int slot = entry->slot;
+  size_t hole = entry - entries;
+
+  // Backward shift deletion keeps probe chains intact without tombstones
+  for (size_t i = (hole + 1) & mask; entries[i].key != 0; i = (i + 1) & mask) {
+    size_t home = __hash_key(entries[i].key, mask);
+
+    // Move the entry into the hole unless its home lies between hole and i
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      entries[hole] = entries[i];
+      hole = i;
+    }
+  }
+
+  entries[hole] = (SlotEntry) { 0, 0 };
+  --index->count;
+
+  return slot;
+}
+
+static void destroy_slot_index(SlotIndex* index) {
+  free(index->entries);
+  *index = (SlotIndex) { NULL, 0, 0 };
+}
+
+/***************************************************************************
+ * Job table
+ ***************************************************************************/
+// The active job in slot, or NULL
+static Job* __job_in_slot(int slot) {
+  if (slot < 0 || slot >= job_table.used || !job_table.slots[slot].active)
+    return NULL;
+
+  return &job_table.slots[slot];
+}
+
+static int __take_slot() {
+  int slot;
+
+  if (job_table.free_head >= 0) {
+    slot = job_table.free_head;
+    job_table.free_head = job_table.slots[slot].next_free;
+    return slot;
+  }
+
+  if (job_table.used == job_table.cap) {
+    int new_cap = job_table.cap == 0 ? JOB_TABLE_INIT_CAP : 2 * job_table.cap;
+    Job* slots = realloc(job_table.slots, new_cap * sizeof(Job));
+
+    if (slots == NULL) {
+      fprintf(stderr, "ERROR: Failed to allocate the job table\n");
+      exit(EXIT_FAILURE);
+    }
+
+    job_table.slots = slots;
+    job_table.cap = new_cap;
+  }
+
+  // Slots below ready keep the storage of the jobs they held before
+  if (job_table.used == job_table.ready) {
+    Job* job = &job_table.slots[job_table.ready++];
+
+    job->command = NULL;
+    job->command_cap = 0;
+    job->process_ids = new_pid_queue(1);
+  }
+
+  return job_table.used++;
+}
+
+// Copies command into the job's buffer, growing it only when it is too small
+static void __store_command(Job* job, const char* command) {
+  size_t len = strlen(command) + 1;
+
+  if (len > job->command_cap) {
+    char* buf = realloc(job->command, len);
+
+    if (buf == NULL) {
+      fprintf(stderr, "ERROR: Failed to allocate a job command\n");
+      exit(EXIT_FAILURE);
+    }
+
+    job->command = buf;
+    job->command_cap = len;
+  }
+
+  memcpy(job->command, command, len);
+}
+
+Job* add_job(const char* command, pid_queue* process_ids) {
+  int slot = __take_slot();
+  Job* job = &job_table.slots[slot];
+
+  __store_command(job, command);
+
+  job->job_id = job_table.next_id++;
+  job->first_pid = 0;
+  job->pgid = 0;
+  job->usage = (JobUsage) { { 0, 0 }, { 0, 0 }, 0, 0, 0 };
+  job->timed = false;
+  job->pending = true;
+  job->stopped = false;
+  job->remaining = 0;
+  job->active = true;
+  job->next_free = -1;
+
+  // The new id is the highest, so the job goes last in id order
+  job->older = job_table.newest;
+  job->newer = -1;
+
+  if (job_table.newest >= 0)
+    job_table.slots[job_table.newest].newer = slot;
+  else
+    job_table.oldest = slot;
+
+  job_table.newest = slot;
+  slot_index_insert(&id_index, job->job_id, slot);
+
+  ++job_table.count;
+
+  if (!is_empty_pid_queue(process_ids))
+    job_started(job, process_ids);
+
+  return job;
+}
+
+void job_started(Job* job, pid_queue* process_ids) {
+  assert(job->pending);
+
+  int slot = job - job_table.slots;
+
+  for (pid_t* pid = iter_first_pid_queue(process_ids); pid != NULL;
+       pid = iter_next_pid_queue(process_ids, pid))
+    push_back_pid_queue(&job->process_ids, *pid);
+
+  job->first_pid = peek_back_pid_queue(&job->process_ids);
+  job->remaining = length_pid_queue(&job->process_ids);
+  job->pending = false;
+
+  // Index every pid so the reaper can find this job directly
+  for (pid_t* pid = iter_first_pid_queue(&job->process_ids); pid != NULL;
+       pid = iter_next_pid_queue(&job->process_ids, pid))
+    slot_index_insert(&pid_index, *pid, slot);
+}
+
+Job* find_job(int job_id) {
+  if (job_id < 1)
+    return NULL;
+
+  return __job_in_slot(slot_index_lookup(&id_index, job_id));
+}
+
+Job* find_job_by_pid(pid_t pid) {
+  return __job_in_slot(slot_index_lookup(&pid_index, pid));
+}
+
+Job* job_process_exited(pid_t pid, const struct rusage* rusage) {
+  Job* job = __job_in_slot(slot_index_remove(&pid_index, pid));
+
+  if (job == NULL)
+    return NULL;
+
+  add_job_usage(&job->usage, rusage);
+
+  if (--job->remaining > 0)
+    return NULL;
+
+  finish_job_usage(&job->usage);
+
+  return job;
+}
+
+void remove_job(Job* job) {
+  assert(job != NULL && job->active);
+
+  int slot = job - job_table.slots;
+
+  // Forget pids of the job that were never reaped through the index
+  while (!is_empty_pid_queue(&job->process_ids)) {
+    pid_t pid = pop_front_pid_queue(&job->process_ids);
+
+    if (slot_index_lookup(&pid_index, pid) == slot)
+      slot_index_remove(&pid_index, pid);
+  }
+
+  // The emptied pid array and the command buffer stay with the slot
+
+  slot_index_remove(&id_index, job->job_id);
+
+  // Unlinked from the id order, but job->newer is left alone so an
+  // iteration that removed this job can still move on from it
+  if (job->older >= 0)
+    job_table.slots[job->older].newer = job->newer;
+  else
+    job_table.oldest = job->newer;
+
+  if (job->newer >= 0)
+    job_table.slots[job->newer].older = job->older;
+  else
+    job_table.newest = job->older;
+
+  job->active = false;
+  job->next_free = job_table.free_head;
+  job_table.free_head = slot;
+  --job_table.count;
+}
+
+Job* first_job() {
+  return __job_in_slot(job_table.oldest);
+}
+
+Job* next_job(Job* job) {
+  // Jobs removed since job was reached are skipped along the links they kept
+  do
+    job = job->newer >= 0 ? &job_table.slots[job->newer] : NULL;
+  while (job != NULL && !job->active);
+
+  return job;
+}
+
+void destroy_job_table() {
+  for (Job* job = first_job(); job != NULL; job = next_job(job))
+    remove_job(job);
+
+  for (int slot = 0; slot < job_table.ready; ++slot) {
+    free(job_table.slots[slot].command);
+    destroy_pid_queue(&job_table.slots[slot].process_ids);
+  }
+
+  free(job_table.slots);
+  job_table = (JobTable) { NULL, 0, 0, 0, 0, -1, -1, -1, 1 };
+
+  destroy_slot_index(&pid_index);
+  destroy_slot_index(&id_index);
+}
+
+/***************************************************************************
+ * Resource accounting
+ ***************************************************************************/
+static uint64_t __now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+JobUsage mk_job_usage() {
+  return (JobUsage) {
+    { 0, 0 },
+    { 0, 0 },
+    0,
+    __now_ns(),
+    0
+  };
+}
+
+void add_job_usage(JobUsage* usage, const struct rusage* rusage) {
+  timeradd(&usage->utime, &rusage->ru_utime, &usage->utime);
+  timeradd(&usage->stime, &rusage->ru_stime, &usage->stime);
+
+  if (rusage->ru_maxrss > usage->maxrss)
+    usage->maxrss = rusage->ru_maxrss;
+}
+
+void finish_job_usage(JobUsage* usage) {
+  usage->end_ns = __now_ns();
+}
+
+uint64_t job_usage_elapsed_ns(const JobUsage* usage) {
+  return (usage->end_ns != 0 ? usage->end_ns : __now_ns()) - usage->start_ns;
+}
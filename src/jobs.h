@@ -0,0 +1,84 @@
+#ifndef SRC_JOBS_H
+#define SRC_JOBS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include "deque.h"
+
+IMPLEMENT_DEQUE_STRUCT(pid_queue, pid_t);
+PROTOTYPE_DEQUE(pid_queue, pid_t);
+
+// Resources used by the processes of a job or a foreground pipeline
+typedef struct JobUsage {
+  struct timeval utime; // User CPU time of the reaped processes
+  struct timeval stime; // System CPU time of the reaped processes
+  long maxrss;          // Largest resident set of a reaped process, in KB
+  uint64_t start_ns;    // Monotonic time the processes were started
+  uint64_t end_ns;      // Monotonic time the last one was reaped, 0 if running
+} JobUsage;
+
+typedef struct Job {
+  int job_id;            // Unique job identifier, never reused
+  char* command;         // Command string associated with the job
+  size_t command_cap;    // Bytes allocated for command, kept across reuse
+  pid_queue process_ids; // Process IDs of every stage of the job
+  pid_t first_pid;       // Process ID reported for the job, 0 while pending
+  pid_t pgid;            // Process group of every stage, 0 if it has none
+  JobUsage usage;        // Resources used by the stages reaped so far
+  bool timed;            // Report usage on completion, as for `time cmd &`
+  bool pending;          // Waiting for a free slot, no process started yet
+  bool stopped;          // A stage was stopped by a signal and not continued
+  int remaining;         // Processes of the job that have not been reaped
+  bool active;           // False while the slot is on the free list
+  int next_free;         // Next free slot when inactive
+  int older;             // Active slot before this one in id order, or -1
+  int newer;             // Active slot after this one in id order, or -1
+} Job;
+
+// Registers a background job and indexes all of its pids. The command and
+// pids are copied into storage the job's slot keeps after the job completes,
+// so once the table has grown to its peak size new jobs allocate nothing.
+// A job added with no pids is pending until job_started() is called.
+Job* add_job(const char* command, pid_queue* process_ids);
+
+// Gives a pending job the pids of its processes and indexes them
+void job_started(Job* job, pid_queue* process_ids);
+
+// Returns the job with the given id, or NULL. Constant time.
+Job* find_job(int job_id);
+
+// Returns the job owning a running pid, or NULL. Constant time.
+Job* find_job_by_pid(pid_t pid);
+
+// Marks pid as reaped and adds its rusage to the job. Returns its job if that
+// was the job's last running process, NULL otherwise. The returned job must be
+// released with remove_job.
+Job* job_process_exited(pid_t pid, const struct rusage* rusage);
+
+void remove_job(Job* job);
+
+// Iterates over the active jobs in id order. The loop body may remove the
+// job it is on:
+//   for (Job* j = first_job(); j != NULL; j = next_job(j))
+Job* first_job();
+
+Job* next_job(Job* job);
+
+void destroy_job_table();
+
+// Starts accounting for processes launched from now on
+JobUsage mk_job_usage();
+
+// Adds the rusage of a reaped process
+void add_job_usage(JobUsage* usage, const struct rusage* rusage);
+
+// Records that the last process has been reaped
+void finish_job_usage(JobUsage* usage);
+
+// Wall clock time from the start until the end, or until now if running
+uint64_t job_usage_elapsed_ns(const JobUsage* usage);
+
+#endif
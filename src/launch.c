@@ -0,0 +1,300 @@
+/* launch.c
+ *
+ * Process creation for external programs. A plain fork() has to copy the
+ * page tables of the whole shell, so its cost grows with quash's heap. The
+ * vfork() and posix_spawn() engines borrow the parent's address space until
+ * the exec and cost the same no matter how large quash gets. glibc builds
+ * posix_spawn() on clone(CLONE_VM | CLONE_VFORK).
+ *
+ * A child can also be put in a process group, so a job can be signalled as
+ * one with killpg(). Each engine joins the group in the child before exec,
+ * and quash repeats the setpgid() after the launch, so the group exists
+ * whichever side runs first.
+ *
+ * As with execvp(), an executable the kernel cannot run (ENOEXEC), such as a
+ * script without a #! line, is run again by /bin/sh with its path as the
+ * script argument.
+ */
+
+#define _GNU_SOURCE // posix_spawn_file_actions_addtcsetpgrp_np()
+
+#include "launch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// posix_spawn() can only hand over the terminal itself from glibc 2.35
+#ifdef __GLIBC_PREREQ
+#if __GLIBC_PREREQ(2, 35)
+#define HAVE_SPAWN_TCSETPGRP
+#endif
+#endif
+
+// Ignored by quash under job control, but a job has to be stoppable
+static const int job_signals[] = { SIGTSTP, SIGTTIN, SIGTTOU };
+
+#define SCRIPT_SHELL "/bin/sh"
+
+LaunchFds mk_launch_fds(int in, int out, const char* redirect_in,
+                        const char* redirect_out, bool append) {
+  return (LaunchFds) {
+    in,
+    out,
+    redirect_in,
+    redirect_out,
+    append,
+    -1,
+    false
+  };
+}
+
+LaunchEngine default_launch_engine() {
+  const char* name = getenv("QUASH_LAUNCH");
+
+  if (name == NULL || strcmp(name, "spawn") == 0)
+    return LAUNCH_SPAWN;
+
+  if (strcmp(name, "vfork") == 0)
+    return LAUNCH_VFORK;
+
+  if (strcmp(name, "fork") == 0)
+    return LAUNCH_FORK;
+
+  fprintf(stderr, "WARNING: Unknown QUASH_LAUNCH engine \"%s\", using spawn\n", name);
+
+  return LAUNCH_SPAWN;
+}
+
+const char* launch_engine_name(LaunchEngine engine) {
+  switch (engine) {
+  case LAUNCH_FORK:
+    return "fork";
+
+  case LAUNCH_VFORK:
+    return "vfork";
+
+  case LAUNCH_SPAWN:
+    return "spawn";
+
+  default:
+    return "???";
+  }
+}
+
+static inline int __out_flags(const LaunchFds* fds) {
+  return O_WRONLY | O_CREAT | (fds->append ? O_APPEND : O_TRUNC);
+}
+
+static size_t __count_args(char** argv) {
+  size_t argc = 0;
+
+  while (argv[argc] != NULL)
+    ++argc;
+
+  return argc;
+}
+
+// Fills sh_argv, which has room for argc + 2 entries, with the arguments
+// that run path as a script: /bin/sh path argv[1]...
+static void __script_args(const char* path, char** argv, size_t argc, char** sh_argv) {
+  sh_argv[0] = SCRIPT_SHELL;
+  sh_argv[1] = (char*) path;
+
+  for (size_t i = 1; i <= argc; ++i)
+    sh_argv[i + 1] = argv[i]; // Copies the NULL terminator last
+}
+
+// Child side of the fork and vfork engines. Only async-signal-safe calls are
+// allowed here since a vfork child shares memory with quash.
+static void __exec_child(const char* path, char** argv, char** envp,
+                         const LaunchFds* fds) {
+  int fd;
+  struct sigaction sa;
+
+  sa.sa_handler = SIG_DFL;
+  sa.sa_flags = 0;
+  sigemptyset(&sa.sa_mask);
+
+  // quash ignores SIGPIPE while it runs a builtin, which may launch programs
+  sigaction(SIGPIPE, &sa, NULL);
+
+  // Before the dups, while stdin is still quash's terminal
+  if (fds->pgid >= 0) {
+    setpgid(0, fds->pgid);
+
+    if (fds->terminal)
+      tcsetpgrp(STDIN_FILENO, getpgrp());
+
+    for (size_t i = 0; i < sizeof(job_signals) / sizeof(*job_signals); ++i)
+      sigaction(job_signals[i], &sa, NULL);
+  }
+
+  if (fds->in >= 0 && fds->in != STDIN_FILENO) {
+    dup2(fds->in, STDIN_FILENO);
+    close(fds->in);
+  }
+
+  if (fds->out >= 0 && fds->out != STDOUT_FILENO) {
+    dup2(fds->out, STDOUT_FILENO);
+    close(fds->out);
+  }
+
+  if (fds->redirect_in != NULL) {
+    if ((fd = open(fds->redirect_in, O_RDONLY)) < 0)
+      goto fail;
+
+    dup2(fd, STDIN_FILENO);
+    close(fd);
+  }
+
+  if (fds->redirect_out != NULL) {
+    if ((fd = open(fds->redirect_out, __out_flags(fds), 0666)) < 0)
+      goto fail;
+
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+  }
+
+  exec_program(path, argv, envp);
+
+fail:;
+  static const char msg[] = "ERROR: Failed to execute program\n";
+  write(STDERR_FILENO, msg, sizeof(msg) - 1);
+  _exit(EXIT_FAILURE);
+}
+
+void exec_program(const char* path, char** argv, char** envp) {
+  execve(path, argv, envp);
+
+  if (errno == ENOEXEC) {
+    size_t argc = __count_args(argv);
+    char* sh_argv[argc + 2]; // On the stack, since malloc is not safe here
+
+    __script_args(path, argv, argc, sh_argv);
+    execve(SCRIPT_SHELL, sh_argv, envp);
+    errno = ENOEXEC; // The program's own error, not the shell's
+  }
+}
+
+static pid_t __launch_fork(const char* path, char** argv, char** envp,
+                           const LaunchFds* fds) {
+  pid_t pid = fork();
+
+  if (pid == 0)
+    __exec_child(path, argv, envp, fds);
+
+  return pid;
+}
+
+static pid_t __launch_vfork(const char* path, char** argv, char** envp,
+                            const LaunchFds* fds) {
+  pid_t pid = vfork();
+
+  if (pid == 0)
+    __exec_child(path, argv, envp, fds);
+
+  return pid;
+}
+
+static pid_t __launch_spawn(const char* path, char** argv, char** envp,
+                            const LaunchFds* fds) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  pid_t pid;
+  sigset_t defaults;
+  int err;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawnattr_init(&attr);
+
+  // quash ignores SIGPIPE while it runs a builtin, which may launch programs
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGPIPE);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+  if (fds->pgid >= 0) {
+    for (size_t i = 0; i < sizeof(job_signals) / sizeof(*job_signals); ++i)
+      sigaddset(&defaults, job_signals[i]);
+
+    posix_spawnattr_setpgroup(&attr, fds->pgid);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF);
+
+#ifdef HAVE_SPAWN_TCSETPGRP
+    // First action, while stdin is still quash's terminal
+    if (fds->terminal)
+      posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+#endif
+  }
+
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+
+  if (fds->in >= 0 && fds->in != STDIN_FILENO) {
+    posix_spawn_file_actions_adddup2(&actions, fds->in, STDIN_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds->in);
+  }
+
+  if (fds->out >= 0 && fds->out != STDOUT_FILENO) {
+    posix_spawn_file_actions_adddup2(&actions, fds->out, STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds->out);
+  }
+
+  if (fds->redirect_in != NULL)
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, fds->redirect_in,
+                                     O_RDONLY, 0);
+
+  if (fds->redirect_out != NULL)
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, fds->redirect_out,
+                                     __out_flags(fds), 0666);
+
+  err = posix_spawn(&pid, path, &actions, &attr, argv, envp);
+
+  if (err == ENOEXEC) {
+    size_t argc = __count_args(argv);
+    char** sh_argv = malloc((argc + 2) * sizeof(char*));
+
+    __script_args(path, argv, argc, sh_argv);
+    err = posix_spawn(&pid, SCRIPT_SHELL, &actions, &attr, sh_argv, envp);
+    free(sh_argv);
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+
+  if (err != 0) {
+    errno = err;
+    perror("ERROR: Failed to execute program");
+    return -1;
+  }
+
+  return pid;
+}
+
+pid_t launch_program(LaunchEngine engine, const char* path, char** argv,
+                     char** envp, const LaunchFds* fds) {
+  pid_t pid;
+
+  switch (engine) {
+  case LAUNCH_VFORK:
+    pid = __launch_vfork(path, argv, envp, fds);
+    break;
+
+  case LAUNCH_SPAWN:
+    return __launch_spawn(path, argv, envp, fds);
+
+  case LAUNCH_FORK:
+  default:
+    pid = __launch_fork(path, argv, envp, fds);
+    break;
+  }
+
+  if (pid < 0)
+    perror("ERROR: Failed to create process");
+
+  return pid;
+}
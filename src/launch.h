@@ -0,0 +1,45 @@
+#ifndef SRC_LAUNCH_H
+#define SRC_LAUNCH_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Strategies for starting an external program
+typedef enum LaunchEngine {
+  LAUNCH_FORK = 0, // fork() then exec in the child
+  LAUNCH_VFORK,    // vfork() sharing the parent's address space until exec
+  LAUNCH_SPAWN     // posix_spawn() with file actions for the redirects
+} LaunchEngine;
+
+// Descriptor and process group setup applied in the child before exec
+typedef struct LaunchFds {
+  int in;                   // Installed as stdin and closed, or -1
+  int out;                  // Installed as stdout and closed, or -1
+  const char* redirect_in;  // File opened as stdin after the pipes, or NULL
+  const char* redirect_out; // File opened as stdout after the pipes, or NULL
+  bool append;              // Append to redirect_out rather than truncate
+  pid_t pgid;               // Group to join, 0 to lead a new one, -1 to stay in quash's
+  bool terminal;            // Hand the controlling terminal to that group
+} LaunchFds;
+
+// Descriptors for a child that stays in quash's process group
+LaunchFds mk_launch_fds(int in, int out, const char* redirect_in,
+                        const char* redirect_out, bool append);
+
+// Engine named by $QUASH_LAUNCH ("fork", "vfork" or "spawn"), spawn if unset
+LaunchEngine default_launch_engine();
+
+const char* launch_engine_name(LaunchEngine engine);
+
+// Starts path with argv and the environment envp using the given engine.
+// Returns the child pid, or -1 with an error printed if the program could not
+// be started.
+pid_t launch_program(LaunchEngine engine, const char* path, char** argv,
+                     char** envp, const LaunchFds* fds);
+
+// Replaces the process with path, as execve() does, running it with /bin/sh
+// if it is a script without a #! line. Async-signal-safe. Returns only on
+// failure, with errno set.
+void exec_program(const char* path, char** argv, char** envp);
+
+#endif
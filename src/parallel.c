@@ -0,0 +1,403 @@
+/* parallel.c
+ *
+ * The parallel builtin fans a command template out over a list of inputs.
+ * Each task is an ordinary generic command started through create_process,
+ * and a fixed set of worker slots keeps N of them running. Tasks are waited
+ * for by pid, never with wait(-1), so background jobs exiting meanwhile are
+ * left for the job reaper.
+ *
+ * With -k every task writes into its own memfd, reached by the child through
+ * /proc/self/fd. A task's output is copied to stdout once it and every task
+ * before it have finished. Tasks only start up to OUTPUT_WINDOW inputs past
+ * the worker slots ahead of the next output to print, which bounds the
+ * memfds held open while a slow task holds up the rest.
+ */
+
+#define _GNU_SOURCE // memfd_create()
+
+#include "parallel.h"
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "execute.h"
+
+#define OUTPUT_PATH_SIZE 32
+#define OUTPUT_WINDOW 16 // Finished tasks a -k run keeps beyond its workers
+
+// A worker slot
+typedef struct Task {
+  pid_t pid;         // 0 while the slot is free
+  size_t index;      // Input the task is running for
+  uint64_t start_ns;
+} Task;
+
+typedef struct Parallel {
+  char** command;     // Template, NULL terminated
+  bool has_slot;      // Some argument of the template holds {}
+  char** inputs;
+  size_t count;
+  char* input_text;   // Buffer the inputs point into when read from stdin
+  long workers;
+  bool keep_order;    // -k
+  bool verbose;       // -v
+  int* outputs;       // memfd holding each task's output with -k, or -1
+  bool* done;
+  size_t next_output; // First input whose output has not been printed
+} Parallel;
+
+static uint64_t __now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**************************************************************************
+ * Arguments and inputs
+ **************************************************************************/
+static bool __parse_workers(const char* str, long* workers) {
+  char* end;
+
+  *workers = str != NULL ? strtol(str, &end, 10) : 0;
+
+  if (str == NULL || *end != '\0' || *workers < 1) {
+    fprintf(stderr, "parallel: -j needs a positive number\n");
+    return false;
+  }
+
+  return true;
+}
+
+// Splits the input lines read from stdin in place
+static bool __read_inputs(Parallel* p) {
+  size_t len = 0;
+  size_t cap = 4096;
+  ssize_t n;
+  char* text = malloc(cap + 1);
+
+  while ((n = read(STDIN_FILENO, text + len, cap - len)) != 0) {
+    if (n < 0) {
+      perror("parallel: stdin");
+      free(text);
+      return false;
+    }
+
+    if ((len += n) == cap)
+      text = realloc(text, (cap *= 2) + 1);
+  }
+
+  text[len] = '\0';
+
+  size_t lines = 0;
+
+  for (size_t i = 0; i < len; ++i)
+    lines += text[i] == '\n';
+
+  p->inputs = malloc((lines + 1) * sizeof(char*));
+  p->input_text = text;
+  p->count = 0;
+
+  for (char* line = text; line < text + len;) {
+    char* end = strchr(line, '\n');
+
+    if (end != NULL)
+      *end = '\0';
+
+    p->inputs[p->count++] = line;
+    line = end != NULL ? end + 1 : text + len;
+  }
+
+  return true;
+}
+
+static bool __parse_parallel(char** args, Parallel* p) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  *p = (Parallel) { NULL, false, NULL, 0, NULL, cpus > 0 ? cpus : 1, false, false, NULL, NULL, 0 };
+
+  for (; *args != NULL && (*args)[0] == '-'; ++args) {
+    if (strcmp(*args, "-k") == 0)
+      p->keep_order = true;
+    else if (strcmp(*args, "-v") == 0)
+      p->verbose = true;
+    else if (strncmp(*args, "-j", 2) == 0) {
+      if (!__parse_workers((*args)[2] != '\0' ? *args + 2 : *++args, &p->workers))
+        return false;
+    }
+    else {
+      fprintf(stderr, "parallel: %s: invalid option\n", *args);
+      return false;
+    }
+  }
+
+  size_t argc = 0;
+
+  // The template ends at :::, and the inputs are the arguments after it
+  for (; args[argc] != NULL && strcmp(args[argc], ":::") != 0; ++argc) {
+    if (strstr(args[argc], "{}") != NULL)
+      p->has_slot = true;
+  }
+
+  if (argc == 0) {
+    fprintf(stderr, "parallel: usage: parallel [-j N] [-k] [-v] command [args...] [::: inputs...]\n");
+    return false;
+  }
+
+  p->command = malloc((argc + 1) * sizeof(char*));
+  memcpy(p->command, args, argc * sizeof(char*));
+  p->command[argc] = NULL;
+
+  if (args[argc] != NULL)
+    p->inputs = args + argc + 1;
+
+  if (p->inputs != NULL) {
+    while (p->inputs[p->count] != NULL)
+      ++p->count;
+
+    return true;
+  }
+
+  return __read_inputs(p);
+}
+
+// Copies str into pos with every {} replaced by input, returning the byte
+// after the copy's terminator. With pos NULL only the length is counted.
+static size_t __substitute(char* pos, const char* str, const char* input, size_t input_len) {
+  size_t len = 0;
+
+  for (const char* slot; (slot = strstr(str, "{}")) != NULL; str = slot + 2) {
+    if (pos != NULL) {
+      memcpy(pos + len, str, slot - str);
+      memcpy(pos + len + (slot - str), input, input_len);
+    }
+
+    len += (slot - str) + input_len;
+  }
+
+  size_t rest = strlen(str) + 1;
+
+  if (pos != NULL)
+    memcpy(pos + len, str, rest);
+
+  return len + rest;
+}
+
+// Builds the arguments of one task in a single malloc'd block
+static char** __task_args(const Parallel* p, const char* input) {
+  size_t input_len = strlen(input);
+  size_t argc = 0;
+  size_t bytes = 0;
+
+  for (; p->command[argc] != NULL; ++argc)
+    bytes += __substitute(NULL, p->command[argc], input, input_len);
+
+  size_t total_args = argc + !p->has_slot; // The input goes last without {}
+  char** args = malloc((total_args + 1) * sizeof(char*) + bytes + input_len + 1);
+  char* pos = (char*) (args + total_args + 1);
+
+  for (size_t i = 0; i < argc; ++i) {
+    args[i] = pos;
+    pos += __substitute(pos, p->command[i], input, input_len);
+  }
+
+  if (!p->has_slot)
+    args[argc] = memcpy(pos, input, input_len + 1);
+
+  args[total_args] = NULL;
+
+  return args;
+}
+
+/**************************************************************************
+ * Tasks
+ **************************************************************************/
+// Prints one line about a finished task to stderr
+static void __report(const Parallel* p, const Task* task, int status) {
+  double seconds = (__now_ns() - task->start_ns) / 1e9;
+  const char* input = p->inputs[task->index];
+
+  if (WIFEXITED(status))
+    fprintf(stderr, "parallel: [%zu] exit %d %.3fs %s\n", task->index + 1,
+            WEXITSTATUS(status), seconds, input);
+  else if (WIFSIGNALED(status))
+    fprintf(stderr, "parallel: [%zu] signal %d %.3fs %s\n", task->index + 1,
+            WTERMSIG(status), seconds, input);
+}
+
+// Starts the task for input index in the given slot. Returns false if no
+// process could be started.
+static bool __start_task(Parallel* p, Task* task, size_t index) {
+  char path[OUTPUT_PATH_SIZE];
+  char* redirect_out = NULL;
+  int flags = 0;
+
+  if (p->keep_order) {
+    // Without a buffer the output could not be kept in order
+    if ((p->outputs[index] = memfd_create("parallel", MFD_CLOEXEC)) < 0) {
+      fprintf(stderr, "parallel: [%zu] ", index + 1);
+      perror("memfd_create");
+      p->done[index] = true;
+      return false;
+    }
+
+    // Opened by the child before exec, while the descriptor is still open
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", p->outputs[index]);
+    redirect_out = path;
+    flags = REDIRECT_OUT;
+  }
+
+  char** args = __task_args(p, p->inputs[index]);
+
+  task->index = index;
+  task->start_ns = __now_ns();
+  task->pid = start_background_command(mk_command_holder(NULL, redirect_out, flags,
+                                                         mk_generic_command(args)));
+  free(args); // The process has its own copy
+
+  if (task->pid <= 0) {
+    task->pid = 0;
+    p->done[index] = true;
+    return false;
+  }
+
+  return true;
+}
+
+// Waits for any running task to exit and returns its slot. SIGCHLD is only
+// blocked here, outside sigsuspend, so a task exiting after the scan still
+// wakes the wait up. Tasks are started with it unblocked, since a blocked
+// mask would survive their exec. Other children are left alone.
+static Task* __wait_task(Task* tasks, long workers, int* status) {
+  sigset_t chld;
+  sigset_t old_mask;
+  sigset_t wait_mask;
+
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld, &old_mask);
+  wait_mask = old_mask;
+  sigdelset(&wait_mask, SIGCHLD);
+
+  for (;;) {
+    for (long w = 0; w < workers; ++w) {
+      if (tasks[w].pid > 0 && waitpid(tasks[w].pid, status, WNOHANG) == tasks[w].pid) {
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        return &tasks[w];
+      }
+    }
+
+    sigsuspend(&wait_mask);
+  }
+}
+
+// Prints the buffered outputs that are next in input order
+static void __flush_outputs(Parallel* p) {
+  char buf[1 << 16];
+
+  fflush(stdout);
+
+  for (; p->next_output < p->count && p->done[p->next_output]; ++p->next_output) {
+    int fd = p->outputs[p->next_output];
+    off_t offset = 0;
+    ssize_t n;
+
+    if (fd < 0)
+      continue;
+
+    while ((n = pread(fd, buf, sizeof(buf), offset)) > 0) {
+      if (write(STDOUT_FILENO, buf, n) != n)
+        break;
+
+      offset += n;
+    }
+
+    close(fd);
+    p->outputs[p->next_output] = -1;
+  }
+}
+
+void run_parallel(ParallelCommand cmd) {
+  Parallel p;
+
+  if (!__parse_parallel(cmd.args, &p)) {
+    free(p.command);
+    return;
+  }
+
+  Task* tasks = calloc(p.workers, sizeof(Task));
+  size_t next = 0;
+  long running = 0;
+  int failed = 0;
+  uint64_t start = __now_ns();
+
+  p.done = calloc(p.count + 1, sizeof(bool));
+  p.outputs = malloc((p.count + 1) * sizeof(int));
+
+  for (size_t i = 0; i < p.count; ++i)
+    p.outputs[i] = -1;
+
+  fflush(stdout); // Tasks write to the same stdout
+
+  while (next < p.count || running > 0) {
+    if (p.keep_order)
+      __flush_outputs(&p); // Also moves past tasks that could not start
+
+    // Keep every worker slot busy, within the window of kept outputs. The
+    // task holding up the window is then still running, so this never stalls.
+    size_t window = p.keep_order ? p.next_output + p.workers + OUTPUT_WINDOW : p.count;
+
+    for (long w = 0; w < p.workers && next < p.count && next < window; ++w) {
+      if (tasks[w].pid != 0)
+        continue;
+
+      if (__start_task(&p, &tasks[w], next++))
+        ++running;
+      else
+        ++failed;
+    }
+
+    if (running == 0)
+      continue;
+
+    int status;
+    Task* task = __wait_task(tasks, p.workers, &status);
+
+    --running;
+    p.done[task->index] = true;
+
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    failed += !ok;
+
+    if (p.verbose || !ok)
+      __report(&p, task, status);
+
+    task->pid = 0;
+  }
+
+  if (p.keep_order)
+    __flush_outputs(&p); // Outputs after tasks that could not start
+
+  if (p.verbose)
+    fprintf(stderr, "parallel: %zu tasks, %d failed, %.3fs\n", p.count, failed,
+            (__now_ns() - start) / 1e9);
+
+  free(tasks);
+  free(p.command);
+  free(p.done);
+  free(p.outputs);
+
+  if (p.input_text != NULL) {
+    free(p.input_text);
+    free(p.inputs);
+  }
+}
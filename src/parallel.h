@@ -0,0 +1,16 @@
+#ifndef SRC_PARALLEL_H
+#define SRC_PARALLEL_H
+
+#include "command.h"
+
+// parallel [-j N] [-k] [-v] command [args...] [::: inputs...]
+//
+// Runs command once per input with at most N (default: online CPUs) copies
+// running at once. {} in the arguments is replaced by the input, which is
+// appended when no argument holds {}. Inputs come after ::: or, without it,
+// one per line from stdin. -k prints the output of each task in input order,
+// and -v reports the exit status and time of every task rather than only
+// of failed ones.
+void run_parallel(ParallelCommand cmd);
+
+#endif
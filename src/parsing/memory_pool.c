@@ -1,6 +1,8 @@
 #include "memory_pool.h"
 
 #include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,7 +19,10 @@ typedef struct MemoryPool {
 IMPLEMENT_DEQUE_STRUCT(MemoryPoolDeque, MemoryPool);
 IMPLEMENT_DEQUE(MemoryPoolDeque, MemoryPool);
 
+#define DEFAULT_RETAIN_LIMIT (1 << 20)
+
 static MemoryPoolDeque pool_deq = { NULL, 0, 0, 0, NULL };
+static size_t retain_limit = DEFAULT_RETAIN_LIMIT;
 
 static MemoryPool __initialize_memory_pool(size_t size) {
   void* mem;
@@ -80,8 +85,18 @@ void initialize_memory_pool(size_t size) {
   push_back_MemoryPoolDeque(&pool_deq, pool);
 }
 
+// First address at or after ptr that is a multiple of align
+static inline void* __align_up(void* ptr, size_t align) {
+  return (void*) (((uintptr_t) ptr + align - 1) & ~(uintptr_t) (align - 1));
+}
+
 void* memory_pool_alloc(size_t size) {
+  return memory_pool_alloc_aligned(size, _Alignof(max_align_t));
+}
+
+void* memory_pool_alloc_aligned(size_t size, size_t align) {
   assert(!is_empty_MemoryPoolDeque(&pool_deq));
+  assert(align != 0 && (align & (align - 1)) == 0);
 
   MemoryPool pool = peek_back_MemoryPoolDeque(&pool_deq);
   size_t init_size = peek_front_MemoryPoolDeque(&pool_deq).size;
@@ -90,7 +105,8 @@ void* memory_pool_alloc(size_t size) {
   assert(pool.size != 0);
   assert(pool.next != NULL);
 
-  while (pool.next - pool.pool + size > pool.size) {
+  // Chunks come from malloc, so a fresh chunk is always aligned well enough
+  while (__align_up(pool.next, align) - pool.pool + size > pool.size) {
     size_t length_pool_deq = length_MemoryPoolDeque(&pool_deq);
     size_t new_pool_size = init_size * (2 << (length_pool_deq - 1));
 
@@ -110,8 +126,8 @@ void* memory_pool_alloc(size_t size) {
   }
 
   assert(pool.next == peek_back_MemoryPoolDeque(&pool_deq).next);
-  void* ret = pool.next;
-  pool.next += size;
+  void* ret = __align_up(pool.next, align);
+  pool.next = ret + size;
 
  
   update_back_MemoryPoolDeque(&pool_deq, pool);
@@ -120,8 +136,80 @@ void* memory_pool_alloc(size_t size) {
 }
 
 
+void* memory_pool_realloc(void* ptr, size_t old_size, size_t new_size) {
+  assert(!is_empty_MemoryPoolDeque(&pool_deq));
+
+  if (ptr == NULL)
+    return memory_pool_alloc(new_size);
+
+  if (new_size <= old_size)
+    return ptr;
+
+  MemoryPool pool = peek_back_MemoryPoolDeque(&pool_deq);
+
+  // The most recent allocation ends at the bump pointer and can simply be
+  // extended if the chunk has room for it
+  if (ptr >= pool.pool && ptr + old_size == pool.next &&
+      ptr - pool.pool + new_size <= pool.size) {
+    pool.next = ptr + new_size;
+    update_back_MemoryPoolDeque(&pool_deq, pool);
+
+    return ptr;
+  }
+
+  void* ret = memory_pool_alloc(new_size);
+
+  memcpy(ret, ptr, old_size);
+
+  return ret;
+}
+
+
 void destroy_memory_pool() {
-  destroy_MemoryPoolDeque(&pool_deq);
+  if (pool_deq.data != NULL)
+    destroy_MemoryPoolDeque(&pool_deq);
+}
+
+
+void reset_memory_pool() {
+  assert(!is_empty_MemoryPoolDeque(&pool_deq));
+
+  size_t chunks = length_MemoryPoolDeque(&pool_deq);
+
+  if (chunks == 1) {
+    MemoryPool pool = peek_front_MemoryPoolDeque(&pool_deq);
+
+    pool.next = pool.pool;
+    update_front_MemoryPoolDeque(&pool_deq, pool);
+
+    return;
+  }
+
+  // The line outgrew the first chunk. Replace every chunk with a single one
+  // covering the high-water mark so the next line fits without growing.
+  size_t high_water = 0;
+
+  for (size_t i = 0; i < chunks; ++i) {
+    MemoryPool pool = pop_front_MemoryPoolDeque(&pool_deq);
+
+    high_water += pool.size;
+    __destroy_memory_pool(pool);
+  }
+
+  if (high_water > retain_limit)
+    high_water = retain_limit;
+
+  MemoryPool pool = __initialize_memory_pool(high_water);
+
+  if (pool.pool == NULL)
+    pool = __low_memory_initialize_memory_pool(1, high_water);
+
+  push_back_MemoryPoolDeque(&pool_deq, pool);
+}
+
+
+void set_memory_pool_retain_limit(size_t limit) {
+  retain_limit = limit == 0 ? 1 : limit;
 }
 
 
@@ -129,9 +217,9 @@ char* memory_pool_strdup(const char* str) {
   assert(str != NULL);
 
   size_t len = strlen(str) + 1;
-  char* ret = memory_pool_alloc(len);
+  char* ret = memory_pool_alloc_aligned(len, 1); // Strings need no padding
 
-  strcpy(ret, str);
+  memcpy(ret, str, len);
 
   return ret;
 }
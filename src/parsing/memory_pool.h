@@ -2,15 +2,32 @@
 #define SRC_PARSING_MEMORY_POOL_H
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "deque.h"
 
 void initialize_memory_pool(size_t size);
 
+// Allocations are aligned for any type, like malloc
 void* memory_pool_alloc(size_t size);
 
+// Allocates with an explicit power of two alignment
+void* memory_pool_alloc_aligned(size_t size, size_t align);
+
+// Grows an allocation. The most recent allocation is extended in place when
+// its chunk has room, anything else is copied to a new allocation.
+void* memory_pool_realloc(void* ptr, size_t old_size, size_t new_size);
+
 void destroy_memory_pool();
 
+// Rewinds the pool so its memory can be reused by the next command line. The
+// pool keeps one chunk as large as the most it has ever needed, up to the
+// retain limit, so lines of a familiar size need no heap calls at all.
+void reset_memory_pool();
+
+// Largest number of bytes reset_memory_pool keeps around between lines
+void set_memory_pool_retain_limit(size_t limit);
+
 char* memory_pool_strdup(const char* str);
 
 #define IMPLEMENT_DEQUE_MEMORY_POOL(struct_name, type)                  \
@@ -20,10 +37,11 @@ char* memory_pool_strdup(const char* str);
   struct_name new_##struct_name(size_t init_cap) {                      \
     struct_name ret;                                                    \
                                                                         \
-    if (init_cap > 0)                                                   \
-      ret.cap = init_cap;                                               \
-    else                                                                \
-      ret.cap = 1;                                                      \
+    /* Capacities are powers of two so that indices wrap with a mask */ \
+    ret.cap = 1;                                                        \
+                                                                        \
+    while (ret.cap < init_cap)                                          \
+      ret.cap <<= 1;                                                    \
                                                                         \
     ret.data = (type*) memory_pool_alloc(ret.cap * sizeof(type));       \
                                                                         \
@@ -56,8 +74,7 @@ char* memory_pool_strdup(const char* str);
       apply_##struct_name(deq, deq->destructor);                        \
                                                                         \
     deq->data = NULL;                                                   \
-    deq->cap = 0;                                                       \
-    deq->front = deq->back = 0;                                         \
+    deq->cap = deq->front = deq->back = 0;                              \
   }                                                                     \
                                                                         \
   void empty_##struct_name(struct_name* deq) {                          \
@@ -79,7 +96,7 @@ char* memory_pool_strdup(const char* str);
   size_t length_##struct_name(struct_name* deq) {                       \
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
-    return (deq->back - deq->front + deq->cap) % deq->cap;              \
+    return (deq->back - deq->front) & (deq->cap - 1);                   \
   }                                                                     \
                                                                         \
   static void __reallign_##struct_name(struct_name* deq) {              \
@@ -87,24 +104,33 @@ char* memory_pool_strdup(const char* str);
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
                                                                         \
     if (deq->front != 0) {                                              \
-      type* old_data = deq->data;                                       \
       size_t len = length_##struct_name(deq);                           \
                                                                         \
-      deq->data = (type*) memory_pool_alloc(deq->cap * sizeof(type));   \
-                                                                        \
-      if (deq->data == NULL) {                                          \
-        fprintf(stderr, "ERROR: Failed to reallocate struct_name"       \
-                " contents");                                           \
-        abort();                                                        \
+      if (deq->front <= deq->back) {                                    \
+        /* Contents are contiguous, slide them to the start */          \
+        memmove(deq->data, deq->data + deq->front, len * sizeof(type)); \
+      }                                                                 \
+      else {                                                            \
+        /* Contents wrap around, copy both segments in order */         \
+        type* old_data = deq->data;                                     \
+        size_t head_len = deq->cap - deq->front;                        \
+                                                                        \
+        deq->data = (type*) memory_pool_alloc(deq->cap * sizeof(type)); \
+                                                                        \
+        if (deq->data == NULL) {                                        \
+          fprintf(stderr, "ERROR: Failed to reallocate struct_name"     \
+                  " contents");                                         \
+          abort();                                                      \
+        }                                                               \
+                                                                        \
+        memcpy(deq->data, old_data + deq->front,                        \
+               head_len * sizeof(type));                                \
+        memcpy(deq->data + head_len, old_data,                          \
+               deq->back * sizeof(type));                               \
       }                                                                 \
-                                                                        \
-      size_t i;                                                         \
-                                                                        \
-      for (i = 0; i < len; ++i)                                         \
-        deq->data[i] = old_data[(deq->front + i) % deq->cap];           \
                                                                         \
       deq->front = 0;                                                   \
-      deq->back = i;                                                    \
+      deq->back = len;                                                  \
     }                                                                   \
   }                                                                     \
                                                                         \
@@ -132,34 +158,44 @@ char* memory_pool_strdup(const char* str);
     size_t len = length_##struct_name(deq);                             \
                                                                         \
     for (size_t i = 0; i < len; ++i) {                                  \
-      func(deq->data[(deq->front + i) % deq->cap]);                     \
+      func(deq->data[(deq->front + i) & (deq->cap - 1)]);               \
     }                                                                   \
   }                                                                     \
                                                                         \
-  static void __on_push_##struct_name(struct_name* deq) {               \
-    if (deq->front == (deq->back + 1) % deq->cap) {                     \
-      type* old_data = deq->data;                                       \
-      size_t old_cap = deq->cap;                                        \
+  static void __grow_##struct_name(struct_name* deq, size_t min_cap) {  \
+    size_t old_cap = deq->cap;                                          \
+    size_t new_cap = old_cap;                                           \
                                                                         \
-      deq->cap = 2 * deq->cap;                                          \
-      deq->data = (type*) memory_pool_alloc(deq->cap * sizeof(type));   \
+    while (new_cap < min_cap)                                           \
+      new_cap <<= 1;                                                    \
                                                                         \
-      if (deq->data == NULL) {                                          \
-        fprintf(stderr, "ERROR: Failed to reallocate struct_name"       \
-                " contents\n");                                         \
-        abort();                                                        \
-      }                                                                 \
+    if (new_cap == old_cap)                                             \
+      return;                                                           \
                                                                         \
-      size_t i;                                                         \
+    deq->data = (type*) memory_pool_realloc(deq->data,                  \
+                                            old_cap * sizeof(type),     \
+                                            new_cap * sizeof(type));    \
                                                                         \
-      for (i = 0; i < old_cap - 1; ++i)                                 \
-        deq->data[i] = old_data[(deq->front + i) % old_cap];            \
+    if (deq->data == NULL) {                                            \
+      fprintf(stderr, "ERROR: Failed to reallocate struct_name"         \
+              " contents\n");                                           \
+      abort();                                                          \
+    }                                                                   \
                                                                         \
-      deq->front = 0;                                                   \
-      deq->back = i;                                                    \
+    deq->cap = new_cap;                                                 \
+                                                                        \
+    /* Move the wrapped around head after the old end */                \
+    if (deq->back < deq->front) {                                       \
+      memcpy(deq->data + old_cap, deq->data, deq->back * sizeof(type)); \
+      deq->back += old_cap;                                             \
     }                                                                   \
   }                                                                     \
                                                                         \
+  static void __on_push_##struct_name(struct_name* deq) {               \
+    if (deq->front == ((deq->back + 1) & (deq->cap - 1)))               \
+      __grow_##struct_name(deq, 2 * deq->cap);                          \
+  }                                                                     \
+                                                                        \
   static void __on_pop_##struct_name(struct_name* deq) {                \
     if (is_empty_##struct_name(deq)) {                                  \
       fprintf(stderr, "ERROR: Cannot pop from of struct_name while it " \
@@ -172,7 +208,7 @@ char* memory_pool_strdup(const char* str);
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     __on_push_##struct_name(deq);                                       \
-    deq->front = (deq->front + deq->cap - 1) % deq->cap;                \
+    deq->front = (deq->front - 1) & (deq->cap - 1);                     \
     deq->data[deq->front] = element;                                    \
   }                                                                     \
                                                                         \
@@ -181,7 +217,39 @@ char* memory_pool_strdup(const char* str);
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     __on_push_##struct_name(deq);                                       \
     deq->data[deq->back] = element;                                     \
-    deq->back = (deq->back + 1) % deq->cap;                             \
+    deq->back = (deq->back + 1) & (deq->cap - 1);                       \
+  }                                                                     \
+                                                                        \
+  void push_back_n_##struct_name(struct_name* deq, type element,        \
+                                 size_t n) {                            \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL); /* Make sure the structure is valid */   \
+                                                                        \
+    /* One slot always stays free to tell full from empty */            \
+    __grow_##struct_name(deq, length_##struct_name(deq) + n + 1);       \
+                                                                        \
+    for (size_t i = 0; i < n; ++i) {                                    \
+      deq->data[deq->back] = element;                                   \
+      deq->back = (deq->back + 1) & (deq->cap - 1);                     \
+    }                                                                   \
+  }                                                                     \
+                                                                        \
+  void append_array_##struct_name(struct_name* deq, const type* arr,    \
+                                  size_t n) {                           \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL); /* Make sure the structure is valid */   \
+    assert(arr != NULL || n == 0);                                      \
+                                                                        \
+    __grow_##struct_name(deq, length_##struct_name(deq) + n + 1);       \
+                                                                        \
+    size_t first = deq->cap - deq->back;                                \
+                                                                        \
+    if (first > n)                                                      \
+      first = n;                                                        \
+                                                                        \
+    memcpy(deq->data + deq->back, arr, first * sizeof(type));           \
+    memcpy(deq->data, arr + first, (n - first) * sizeof(type));         \
+    deq->back = (deq->back + n) & (deq->cap - 1);                       \
   }                                                                     \
                                                                         \
   type pop_front_##struct_name(struct_name* deq) {                      \
@@ -189,7 +257,7 @@ char* memory_pool_strdup(const char* str);
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     __on_pop_##struct_name(deq);                                        \
     size_t old_front = deq->front;                                      \
-    deq->front = (deq->front + 1) % deq->cap;                           \
+    deq->front = (deq->front + 1) & (deq->cap - 1);                     \
     return deq->data[old_front];                                        \
   }                                                                     \
                                                                         \
@@ -197,7 +265,7 @@ char* memory_pool_strdup(const char* str);
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     __on_pop_##struct_name(deq);                                        \
-    deq->back = (deq->back + deq->cap - 1) % deq->cap;                  \
+    deq->back = (deq->back - 1) & (deq->cap - 1);                       \
     return deq->data[deq->back];                                        \
   }                                                                     \
                                                                         \
@@ -212,7 +280,31 @@ char* memory_pool_strdup(const char* str);
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     assert(!is_empty_##struct_name(deq));                               \
-    return deq->data[(deq->back + deq->cap - 1) % deq->cap];            \
+    return deq->data[(deq->back - 1) & (deq->cap - 1)];                 \
+  }                                                                     \
+                                                                        \
+  type peek_at_##struct_name(struct_name* deq, size_t idx) {            \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL); /* Make sure the structure is valid */   \
+    assert(idx < length_##struct_name(deq));                            \
+    return deq->data[(deq->front + idx) & (deq->cap - 1)];              \
+  }                                                                     \
+                                                                        \
+  type* iter_first_##struct_name(struct_name* deq) {                    \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL); /* Make sure the structure is valid */   \
+    return is_empty_##struct_name(deq) ? NULL                           \
+                                       : &deq->data[deq->front];        \
+  }                                                                     \
+                                                                        \
+  type* iter_next_##struct_name(struct_name* deq, type* it) {           \
+    assert(deq != NULL);                                                \
+    assert(deq->data != NULL); /* Make sure the structure is valid */   \
+    assert(it != NULL);                                                 \
+                                                                        \
+    size_t idx = (it - deq->data + 1) & (deq->cap - 1);                 \
+                                                                        \
+    return idx == deq->back ? NULL : &deq->data[idx];                   \
   }                                                                     \
                                                                         \
   void update_front_##struct_name(struct_name* deq, type element) {     \
@@ -226,7 +318,7 @@ char* memory_pool_strdup(const char* str);
     assert(deq != NULL);                                                \
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     assert(!is_empty_##struct_name(deq));                               \
-    deq->data[(deq->back + deq->cap - 1) % deq->cap] = element;         \
+    deq->data[(deq->back - 1) & (deq->cap - 1)] = element;              \
   }                                                                     \
                                                                         \
   void update_and_destroy_front_##struct_name(struct_name* deq,         \
@@ -249,7 +341,7 @@ char* memory_pool_strdup(const char* str);
     assert(deq->data != NULL); /* Make sure the structure is valid */   \
     assert(!is_empty_##struct_name(deq));                               \
                                                                         \
-    size_t idx = (deq->back + deq->cap - 1) % deq->cap;                 \
+    size_t idx = (deq->back - 1) & (deq->cap - 1);                      \
                                                                         \
     if (deq->destructor != NULL)                                        \
       deq->destructor(deq->data[idx]);                                  \
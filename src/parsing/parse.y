@@ -42,7 +42,7 @@ int yyerrstatus = 0;
 %parse-param { CommandHolder** __ret_cmds }
 
 %token PIPE BCKGRND SQUOTE EQUALS REDIRIN REDIROUT REDIROUTAPP END
-%token ECHO_TOK EXPORT_TOK CD_TOK PWD_TOK JOBS_TOK KILL_TOK EOC_TOK
+%token ECHO_TOK EXPORT_TOK CD_TOK PWD_TOK JOBS_TOK KILL_TOK HASH_TOK TIME_TOK TIMES_TOK PARALLEL_TOK FG_TOK BG_TOK WAIT_TOK EOC_TOK
 %token <str> STR SIM_STR ID NUM EXIT_TOK
 
 %type <str> string first_string special_string
@@ -51,7 +51,7 @@ int yyerrstatus = 0;
 %type <holder> cmd_top
 %type <cmd> cmd_content
 %type <cmd_strs> cmd cmd_arguments
-%type <cmd_list> cmds
+%type <cmd_list> pipeline cmds
 %type <cmd_arr> top
 
 %start top
@@ -63,14 +63,21 @@ top:    EOC_TOK {
 
   YYACCEPT;
 }
-|       cmds EOC_TOK {
+|       END {
+  *__ret_cmds = NULL;
+
+  end_main_loop(EXIT_SUCCESS);
+
+  YYACCEPT;
+}
+|       pipeline EOC_TOK {
   push_back_Cmds(&$1, mk_command_holder(NULL, NULL, 0, mk_eoc()));
 
   *__ret_cmds = as_array_Cmds(&$1, NULL);
 
   YYACCEPT;
 }
-|       cmds END {
+|       pipeline END {
   push_back_Cmds(&$1, mk_command_holder(NULL, NULL, 0, mk_eoc()));
 
   *__ret_cmds = as_array_Cmds(&$1, NULL);
@@ -94,32 +101,52 @@ top:    EOC_TOK {
 
 
 
+pipeline: cmds {
+  $$ = $1;
+}
+|       TIME_TOK cmds {
+  CommandHolder first = peek_front_Cmds(&$2);
+
+  first.flags |= TIMED;
+  update_front_Cmds(&$2, first);
+
+  $$ = $2;
+}
+
+
+
 cmds:   cmd_top {
   Cmds cs = new_Cmds(1);
 
-  push_front_Cmds(&cs, $1);
+  push_back_Cmds(&cs, $1);
 
   $$ = cs;
 }
-|       cmd_top PIPE cmds {
-  CommandHolder prev = pop_front_Cmds(&$3);
+|       cmds PIPE cmd_top {
+  CommandHolder prev = pop_back_Cmds(&$1);
 
-  $1.flags = ($1.flags & ~(REDIRECT_APPEND | REDIRECT_OUT)) | PIPE_OUT;
-  prev.flags = (prev.flags & ~REDIRECT_IN) | PIPE_IN;
+  prev.flags = (prev.flags & ~(REDIRECT_APPEND | REDIRECT_OUT)) | PIPE_OUT;
+  $3.flags = ($3.flags & ~REDIRECT_IN) | PIPE_IN;
 
-  if (prev.flags & BACKGROUND)
-    $1.flags |= BACKGROUND;
+  push_back_Cmds(&$1, prev);
 
-  push_front_Cmds(&$3, prev);
-  push_front_Cmds(&$3, $1);
+  // Only the first command's flags decide whether the line is backgrounded
+  if ($3.flags & BACKGROUND) {
+    CommandHolder first = peek_front_Cmds(&$1);
 
-  $$ = $3;
+    first.flags |= BACKGROUND;
+    update_front_Cmds(&$1, first);
+  }
+
+  push_back_Cmds(&$1, $3);
+
+  $$ = $1;
 }
 
 
 
 cmd_top: cmd_content redir cmd_bg {
-  char flags = (($2.append)? REDIRECT_APPEND : 0) |
+  int flags = (($2.append)? REDIRECT_APPEND : 0) |
     (($2.out)? REDIRECT_OUT : 0) |
     (($2.in)? REDIRECT_IN : 0) |
     ($3? BACKGROUND : 0);
@@ -138,6 +165,8 @@ cmd_content: cmd {
   $$ = mk_echo_command(cmd);
 }
 |       ECHO_TOK cmd_arguments {
+  push_back_CmdStrs(&$2, NULL);
+
   $$ = mk_echo_command(as_array_CmdStrs(&$2, NULL));
 }
 |       EXPORT_TOK ID EQUALS string {
@@ -161,7 +190,52 @@ cmd_content: cmd {
   $$ = mk_pwd_command();
 }
 |       JOBS_TOK {
-  $$ = mk_jobs_command();
+  char** cmd = memory_pool_alloc(sizeof(char*));
+  *cmd = NULL;
+  $$ = mk_jobs_command(cmd);
+}
+|       JOBS_TOK cmd_arguments {
+  push_back_CmdStrs(&$2, NULL);
+
+  $$ = mk_jobs_command(as_array_CmdStrs(&$2, NULL));
+}
+|       TIMES_TOK {
+  $$ = mk_times_command();
+}
+|       PARALLEL_TOK cmd_arguments {
+  push_back_CmdStrs(&$2, NULL);
+
+  $$ = mk_parallel_command(as_array_CmdStrs(&$2, NULL));
+}
+|       FG_TOK {
+  char** cmd = memory_pool_alloc(sizeof(char*));
+  *cmd = NULL;
+  $$ = mk_fg_command(cmd);
+}
+|       FG_TOK cmd_arguments {
+  push_back_CmdStrs(&$2, NULL);
+
+  $$ = mk_fg_command(as_array_CmdStrs(&$2, NULL));
+}
+|       BG_TOK {
+  char** cmd = memory_pool_alloc(sizeof(char*));
+  *cmd = NULL;
+  $$ = mk_bg_command(cmd);
+}
+|       BG_TOK cmd_arguments {
+  push_back_CmdStrs(&$2, NULL);
+
+  $$ = mk_bg_command(as_array_CmdStrs(&$2, NULL));
+}
+|       WAIT_TOK {
+  char** cmd = memory_pool_alloc(sizeof(char*));
+  *cmd = NULL;
+  $$ = mk_wait_command(cmd);
+}
+|       WAIT_TOK cmd_arguments {
+  push_back_CmdStrs(&$2, NULL);
+
+  $$ = mk_wait_command(as_array_CmdStrs(&$2, NULL));
 }
 |       EXIT_TOK {
   $$ = mk_exit_command();
@@ -169,6 +243,16 @@ cmd_content: cmd {
 |       KILL_TOK NUM NUM {
   $$ = mk_kill_command($2, $3);
 }
+|       HASH_TOK {
+  char** cmd = memory_pool_alloc(sizeof(char*));
+  *cmd = NULL;
+  $$ = mk_hash_command(cmd);
+}
+|       HASH_TOK cmd_arguments {
+  push_back_CmdStrs(&$2, NULL);
+
+  $$ = mk_hash_command(as_array_CmdStrs(&$2, NULL));
+}
 
 redir: redir_inner {
   $$ = $1;
@@ -234,13 +318,14 @@ cmd_bg: {
 
 cmd:    first_string cmd_arguments {
   push_front_CmdStrs(&$2, $1);
+  push_back_CmdStrs(&$2, NULL);
 
   $$ = $2;
 }
 |       first_string {
-  CmdStrs args = new_CmdStrs(1);
+  CmdStrs args = new_CmdStrs(2);
 
-  push_front_CmdStrs(&args, $1);
+  push_back_CmdStrs(&args, $1);
   push_back_CmdStrs(&args, NULL);
 
   $$ = args;
@@ -248,18 +333,19 @@ cmd:    first_string cmd_arguments {
 
 
 
+// Left recursive so the parser stack stays shallow however long the line is.
+// The NULL terminator is appended by the rule that consumes the arguments.
 cmd_arguments: string {
-  CmdStrs args = new_CmdStrs(1);
+  CmdStrs args = new_CmdStrs(4);
 
-  push_front_CmdStrs(&args, $1);
-  push_back_CmdStrs(&args, NULL);
+  push_back_CmdStrs(&args, $1);
 
   $$ = args;
 }
-|       string cmd_arguments {
-  push_front_CmdStrs(&$2, $1);
+|       cmd_arguments string {
+  push_back_CmdStrs(&$1, $2);
 
-  $$ = $2;
+  $$ = $1;
 }
 
 
@@ -289,6 +375,27 @@ special_string: ECHO_TOK {
 |       JOBS_TOK {
   $$ = memory_pool_strdup("jobs");
 }
+|       HASH_TOK {
+  $$ = memory_pool_strdup("hash");
+}
+|       TIME_TOK {
+  $$ = memory_pool_strdup("time");
+}
+|       TIMES_TOK {
+  $$ = memory_pool_strdup("times");
+}
+|       PARALLEL_TOK {
+  $$ = memory_pool_strdup("parallel");
+}
+|       FG_TOK {
+  $$ = memory_pool_strdup("fg");
+}
+|       BG_TOK {
+  $$ = memory_pool_strdup("bg");
+}
+|       WAIT_TOK {
+  $$ = memory_pool_strdup("wait");
+}
 |       EXIT_TOK {
   $$ = $1;
 }
@@ -1,23 +1,29 @@
 #include "parsing_interface.h"
 
 #include <ctype.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "memory_pool.h"
 #include "parse.tab.h"
+#include "trace.h"
 
-IMPLEMENT_DEQUE_STRUCT(SizeStack, size_t);
-IMPLEMENT_DEQUE_STRUCT(StrBuilder, char);
 IMPLEMENT_DEQUE_STRUCT(MPStrBuilder, char);
 
-IMPLEMENT_DEQUE(SizeStack, size_t);
-IMPLEMENT_DEQUE(StrBuilder, char);
 IMPLEMENT_DEQUE_MEMORY_POOL(MPStrBuilder, char);
 IMPLEMENT_DEQUE_MEMORY_POOL(CmdStrs, char*);
 IMPLEMENT_DEQUE_MEMORY_POOL(Cmds, CommandHolder);
 
 extern void destroy_lex();
+extern bool scan_lex_buffer(char* base, size_t size);
+extern void scan_lex_bytes(const char* bytes, size_t len);
+
+static char* script_map = NULL; // Mapping of the script file, if any
+static size_t script_map_len = 0;
 
 
 static inline void __stringify_generic_cmd(GenericCommand cmd, CmdStrs* strs) {
@@ -27,31 +33,60 @@ static inline void __stringify_generic_cmd(GenericCommand cmd, CmdStrs* strs) {
 }
 
 static inline void __stringify_echo_cmd(EchoCommand cmd, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup("echo"));
+  push_back_CmdStrs(strs, (char*) "echo");
+
+  for (size_t i = 0; cmd.args[i] != NULL; ++i)
+    push_back_CmdStrs(strs, cmd.args[i]);
+}
+
+static inline void __stringify_hash_cmd(HashCommand cmd, CmdStrs* strs) {
+  push_back_CmdStrs(strs, (char*) "hash");
+
+  for (size_t i = 0; cmd.args[i] != NULL; ++i)
+    push_back_CmdStrs(strs, cmd.args[i]);
+}
+
+static inline void __stringify_jobs_cmd(JobsCommand cmd, CmdStrs* strs) {
+  push_back_CmdStrs(strs, (char*) "JOBS");
+
+  for (size_t i = 0; cmd.args[i] != NULL; ++i)
+    push_back_CmdStrs(strs, cmd.args[i]);
+}
+
+static inline void __stringify_parallel_cmd(ParallelCommand cmd, CmdStrs* strs) {
+  push_back_CmdStrs(strs, (char*) "parallel");
+
+  for (size_t i = 0; cmd.args[i] != NULL; ++i)
+    push_back_CmdStrs(strs, cmd.args[i]);
+}
+
+// fg, bg and wait
+static inline void __stringify_job_control_cmd(const char* name, GenericCommand cmd, CmdStrs* strs) {
+  push_back_CmdStrs(strs, (char*) name);
 
   for (size_t i = 0; cmd.args[i] != NULL; ++i)
     push_back_CmdStrs(strs, cmd.args[i]);
 }
 
 static void __stringify_export_cmd(ExportCommand cmd, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup("export"));
+  push_back_CmdStrs(strs, (char*) "export");
   push_back_CmdStrs(strs, cmd.env_var);
   push_back_CmdStrs(strs, cmd.val);
 }
 
 static void __stringify_cd_cmd(CDCommand cmd, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup("cd"));
+  push_back_CmdStrs(strs, (char*) "cd");
   push_back_CmdStrs(strs, cmd.dir);
 }
 
 static void __stringify_kill_cmd(KillCommand cmd, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup("kill"));
+  push_back_CmdStrs(strs, (char*) "kill");
   push_back_CmdStrs(strs, cmd.sig_str);
   push_back_CmdStrs(strs, cmd.job_str);
 }
 
 static void __stringify_simple_cmd(const char* str, CmdStrs* strs) {
-  push_back_CmdStrs(strs, memory_pool_strdup(str));
+  push_back_CmdStrs(strs, (char*) str);
 }
 
 static void __stringify_command(Command cmd, CmdStrs* strs) {
@@ -81,7 +116,31 @@ static void __stringify_command(Command cmd, CmdStrs* strs) {
     break;
 
   case JOBS:
-    __stringify_simple_cmd("JOBS", strs);
+    __stringify_jobs_cmd(cmd.jobs, strs);
+    break;
+
+  case TIMES:
+    __stringify_simple_cmd("TIMES", strs);
+    break;
+
+  case PARALLEL:
+    __stringify_parallel_cmd(cmd.parallel, strs);
+    break;
+
+  case FG:
+    __stringify_job_control_cmd("fg", cmd.fg, strs);
+    break;
+
+  case BG:
+    __stringify_job_control_cmd("bg", cmd.bg, strs);
+    break;
+
+  case WAIT:
+    __stringify_job_control_cmd("wait", cmd.wait, strs);
+    break;
+
+  case HASH:
+    __stringify_hash_cmd(cmd.hash, strs);
     break;
 
   case EXIT:
@@ -97,20 +156,20 @@ static void __stringify_holder(CommandHolder holder, CmdStrs* strs) {
   __stringify_command(holder.cmd, strs);
 
   if (holder.flags & REDIRECT_IN) {
-    push_back_CmdStrs(strs, memory_pool_strdup("<"));
+    push_back_CmdStrs(strs, (char*) "<");
     push_back_CmdStrs(strs, holder.redirect_in);
   }
 
   if (holder.flags & REDIRECT_APPEND)
-    push_back_CmdStrs(strs, memory_pool_strdup(">>"));
+    push_back_CmdStrs(strs, (char*) ">>");
   else if (holder.flags & REDIRECT_OUT)
-    push_back_CmdStrs(strs, memory_pool_strdup(">"));
+    push_back_CmdStrs(strs, (char*) ">");
 
   if (holder.flags & REDIRECT_OUT)
     push_back_CmdStrs(strs, holder.redirect_out);
 
   if (holder.flags & PIPE_OUT)
-    push_back_CmdStrs(strs, memory_pool_strdup("|"));
+    push_back_CmdStrs(strs, (char*) "|");
 }
 
 static void __stringify_script(const CommandHolder* holders, CmdStrs* strs) {
@@ -118,38 +177,38 @@ static void __stringify_script(const CommandHolder* holders, CmdStrs* strs) {
   assert(strs != NULL);
 
   if (holders != NULL) {
+    if (holders[0].flags & TIMED)
+      push_back_CmdStrs(strs, (char*) "time");
+
     for (size_t i = 0; get_command_holder_type(holders[i]) != EOC; ++i)
       __stringify_holder(holders[i], strs);
 
     if (holders[0].flags & BACKGROUND)
-      push_back_CmdStrs(strs, memory_pool_strdup("&"));
+      push_back_CmdStrs(strs, (char*) "&");
   }
 
   push_back_CmdStrs(strs, NULL);
 }
 
+// Joins the strings with a space after each one into a single pool string
 static char* __condense_string_array(char** str_arr) {
-  SizeStack ss = new_SizeStack(10);
   size_t len = 0;
 
-  for (size_t i = 0; str_arr[i] != NULL; ++i) {
-    size_t size = strlen(str_arr[i]) + 1;
-
-    push_back_SizeStack(&ss, size);
-    len += size;
-  }
+  for (size_t i = 0; str_arr[i] != NULL; ++i)
+    len += strlen(str_arr[i]) + 1;
 
-  char* ret = (char*) memory_pool_alloc(len + 1);
-  size_t pos = 0;
+  char* ret = (char*) memory_pool_alloc_aligned(len + 1, 1);
+  char* pos = ret;
 
   for (size_t i = 0; str_arr[i] != NULL; ++i) {
-    strcpy(ret + pos, str_arr[i]);
-    pos += pop_front_SizeStack(&ss);
-    ret[pos - 1] = ' ';
+    size_t size = strlen(str_arr[i]);
+
+    memcpy(pos, str_arr[i], size);
+    pos += size;
+    *pos++ = ' ';
   }
 
-  ret[pos] = '\0';
-  destroy_SizeStack(&ss);
+  *pos = '\0';
 
   return ret;
 }
@@ -169,36 +228,43 @@ static void __interpret_deref(MPStrBuilder* bld, const char* str, int* idx) {
 
   pop_back_MPStrBuilder(bld);
 
-  StrBuilder tmp = new_StrBuilder(16);
-  char c;
-
-  while (__is_identifier_char((c = str[++(*idx)])))
-    push_back_StrBuilder(&tmp, c);
+  // Look the name up where it sits in the token rather than copying it out
+  const char* id = str + *idx + 1;
+  size_t len = 0;
 
-  --(*idx);
+  while (__is_identifier_char(id[len]))
+    ++len;
 
-  push_back_StrBuilder(&tmp, '\0');
+  *idx += len;
 
-  char* id = as_array_StrBuilder(&tmp, NULL);
-  const char* env_var = lookup_env(id);
+  const char* env_var = lookup_env_n(id, len);
 
-  free(id);
+  if (env_var != NULL)
+    append_array_MPStrBuilder(bld, env_var, strlen(env_var));
+}
 
-  if (env_var != NULL) {
-    for (int i = 0; env_var[i] != '\0'; ++i)
-      push_back_MPStrBuilder(bld, env_var[i]);
-  }
+// Bytes before the next backslash, quote or dollar sign
+static inline size_t __plain_span(const char* str) {
+  return strcspn(str, "\\'$");
 }
 
 char* interpret_complex_string_token(const char* str) {
   assert(str != NULL);
 
-  MPStrBuilder bld = new_MPStrBuilder(64);
   int i;
   int len = strlen(str);
   bool in_quotes = false;
+  MPStrBuilder bld = new_MPStrBuilder(len + 2); // Grows only for $VAR values
 
   for (i = 0; i <= len; ++i) {
+    // Copy the run of ordinary bytes up to the next special one in bulk
+    size_t span = __plain_span(str + i);
+
+    if (span != 0) {
+      append_array_MPStrBuilder(&bld, str + i, span);
+      i += span;
+    }
+
     push_back_MPStrBuilder(&bld, str[i]);
 
     switch (str[i]) {
@@ -263,22 +329,111 @@ Redirect mk_redirect(char* in, char* out, bool append) {
   };
 }
 
+// Length of text without trailing blank lines and whitespace. The last command
+// of a script then ends at END rather than a newline, which lets run_script
+// know it is the final command. A trailing line continuation is kept.
+static size_t __trimmed_length(const char* text, size_t len) {
+  size_t trimmed = len;
+
+  while (trimmed > 0 && isspace((unsigned char) text[trimmed - 1]))
+    --trimmed;
+
+  if (trimmed > 0 && text[trimmed - 1] == '\\')
+    return len;
+
+  return trimmed;
+}
+
+bool open_script_file(const char* path) {
+  assert(path != NULL);
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+
+  if (fd < 0)
+    return false;
+
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return false;
+  }
+
+  size_t size = st.st_size;
+  size_t page = sysconf(_SC_PAGESIZE);
+
+  // Flex needs two NUL bytes after the text. Reserve zeroed anonymous memory
+  // one page past the file and map the file over the front of it. The tail
+  // of the last file page and the extra page both read as zeros.
+  script_map_len = (size + 2 + page - 1) / page * page;
+  script_map = mmap(NULL, script_map_len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (script_map == MAP_FAILED) {
+    script_map = NULL;
+    close(fd);
+    return false;
+  }
+
+  // Private and writable since flex briefly writes into the buffer
+  if (size > 0 && mmap(script_map, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(script_map, script_map_len);
+    script_map = NULL;
+    close(fd);
+    return false;
+  }
+
+  close(fd);
+  madvise(script_map, size, MADV_SEQUENTIAL);
+
+  size = __trimmed_length(script_map, size);
+  script_map[size] = script_map[size + 1] = '\0';
+
+  return scan_lex_buffer(script_map, size + 2);
+}
+
+void open_script_string(const char* str) {
+  assert(str != NULL);
+
+  scan_lex_bytes(str, __trimmed_length(str, strlen(str)));
+}
+
 CommandHolder* parse(QuashState* state) {
   assert(state != NULL);
 
   CommandHolder* holders;
 
-  yyparse(&holders);
+  uint64_t start = trace_begin();
 
-  if (holders != NULL) {
-    CmdStrs strs = new_CmdStrs(10);
-    __stringify_script(holders, &strs);
-    state->parsed_str = __condense_string_array(as_array_CmdStrs(&strs, NULL));
-  }
+  yyparse(&holders); // Lexing happens on demand inside yyparse
+  trace_end("parse", start, 0, NULL);
+
+  // The command text is only built if a background job asks for it
+  state->parsed_script = holders;
 
   return holders;
 }
 
+char* stringify_script(const CommandHolder* holders) {
+  assert(holders != NULL);
+
+  uint64_t start = trace_begin();
+  CmdStrs strs = new_CmdStrs(10);
+
+  __stringify_script(holders, &strs);
+
+  char* ret = __condense_string_array(as_array_CmdStrs(&strs, NULL));
+
+  trace_end("stringify", start, 0, NULL);
+
+  return ret;
+}
+
 void destroy_parser() {
   destroy_lex();
+
+  if (script_map != NULL) {
+    munmap(script_map, script_map_len);
+    script_map = NULL;
+  }
 }
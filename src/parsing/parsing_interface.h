@@ -28,8 +28,19 @@ Redirect mk_redirect(char* in, char* out, bool append);
 
 char* interpret_complex_string_token(const char* str);
 
+// Read commands from a script file instead of stdin. The file is mapped into
+// memory and lexed in place.
+bool open_script_file(const char* path);
+
+// Read commands from a string, as given to `quash -c`
+void open_script_string(const char* str);
+
 CommandHolder* parse(QuashState* state);
 
+// Rebuilds the text of a parsed command line. The result lives in the memory
+// pool until the pool is reset.
+char* stringify_script(const CommandHolder* holders);
+
 void destroy_parser();
 
 #endif
@@ -0,0 +1,213 @@
+/* path_cache.c
+ *
+ * A parent side cache mapping command names to the executable found by
+ * searching $PATH. The table is open addressed with linear probing and is
+ * dropped whenever $PATH changes or on `hash -r`.
+ */
+
+#include "path_cache.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "execute.h"
+
+#define PATH_CACHE_INIT_CAP 64
+
+typedef struct PathEntry {
+  char* name;  // Command name as typed by the user
+  char* path;  // Resolved executable path
+  size_t hits; // Number of times this entry was used
+} PathEntry;
+
+typedef struct PathCache {
+  PathEntry* entries;
+  size_t cap;    // Always a power of two
+  size_t count;
+  size_t hits;   // Lookups answered from the table
+  size_t misses; // Lookups that required a $PATH search
+} PathCache;
+
+static PathCache cache = { NULL, 0, 0, 0, 0 };
+
+// FNV-1a string hash
+static size_t __hash_name(const char* str) {
+  uint64_t h = 14695981039346656037ULL;
+
+  for (; *str != '\0'; ++str) {
+    h ^= (unsigned char) *str;
+    h *= 1099511628211ULL;
+  }
+
+  return (size_t) h;
+}
+
+// Find the slot holding name, or the empty slot where it would be inserted
+static PathEntry* __find_slot(PathEntry* entries, size_t cap, const char* name) {
+  size_t mask = cap - 1;
+  size_t i = __hash_name(name) & mask;
+
+  while (entries[i].name != NULL && strcmp(entries[i].name, name) != 0)
+    i = (i + 1) & mask;
+
+  return &entries[i];
+}
+
+static void __grow(size_t new_cap) {
+  PathEntry* entries = calloc(new_cap, sizeof(PathEntry));
+
+  if (entries == NULL) {
+    fprintf(stderr, "ERROR: Failed to allocate the path cache\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < cache.cap; ++i) {
+    if (cache.entries[i].name != NULL)
+      *__find_slot(entries, new_cap, cache.entries[i].name) = cache.entries[i];
+  }
+
+  free(cache.entries);
+  cache.entries = entries;
+  cache.cap = new_cap;
+}
+
+// Walk $PATH looking for an executable regular file called cmd
+static char* __search_path(const char* cmd) {
+  const char* path = lookup_env("PATH");
+
+  if (path == NULL)
+    return NULL;
+
+  size_t cmd_len = strlen(cmd);
+  char full_path[PATH_MAX];
+
+  while (true) {
+    const char* end = strchr(path, ':');
+
+    if (end == NULL)
+      end = path + strlen(path);
+
+    size_t dir_len = end - path;
+
+    if (dir_len + cmd_len + 2 <= sizeof(full_path)) {
+      struct stat st;
+
+      // An empty entry in $PATH refers to the current directory
+      if (dir_len == 0) {
+        memcpy(full_path, cmd, cmd_len + 1);
+      }
+      else {
+        memcpy(full_path, path, dir_len);
+        full_path[dir_len] = '/';
+        memcpy(full_path + dir_len + 1, cmd, cmd_len + 1);
+      }
+
+      if (stat(full_path, &st) == 0 && S_ISREG(st.st_mode) &&
+          access(full_path, X_OK) == 0)
+        return strdup(full_path);
+    }
+
+    if (*end == '\0')
+      return NULL;
+
+    path = end + 1;
+  }
+}
+
+static PathEntry* __insert(const char* cmd) {
+  char* path = __search_path(cmd);
+
+  if (path == NULL)
+    return NULL;
+
+  // Keep the load factor at or below one half
+  if (2 * (cache.count + 1) > cache.cap)
+    __grow(cache.cap == 0 ? PATH_CACHE_INIT_CAP : 2 * cache.cap);
+
+  PathEntry* entry = __find_slot(cache.entries, cache.cap, cmd);
+
+  if (entry->name == NULL) {
+    entry->name = strdup(cmd);
+    ++cache.count;
+  }
+  else {
+    free(entry->path);
+  }
+
+  entry->path = path;
+  entry->hits = 0;
+
+  return entry;
+}
+
+const char* path_cache_lookup(const char* cmd) {
+  if (cache.count != 0) {
+    PathEntry* entry = __find_slot(cache.entries, cache.cap, cmd);
+
+    if (entry->name != NULL) {
+      ++cache.hits;
+      ++entry->hits;
+      return entry->path;
+    }
+  }
+
+  ++cache.misses;
+
+  PathEntry* entry = __insert(cmd);
+
+  if (entry == NULL)
+    return NULL;
+
+  ++entry->hits;
+
+  return entry->path;
+}
+
+bool path_cache_insert(const char* cmd) {
+  return __insert(cmd) != NULL;
+}
+
+void path_cache_clear() {
+  for (size_t i = 0; i < cache.cap; ++i) {
+    free(cache.entries[i].name);
+    free(cache.entries[i].path);
+    cache.entries[i] = (PathEntry) { NULL, NULL, 0 };
+  }
+
+  cache.count = 0;
+}
+
+// Lists the table in the same layout as bash's `hash`
+void path_cache_print() {
+  if (cache.count == 0) {
+    printf("hash: hash table empty\n");
+    fflush(stdout);
+    return;
+  }
+
+  printf("hits\tcommand\n");
+
+  for (size_t i = 0; i < cache.cap; ++i) {
+    if (cache.entries[i].name != NULL)
+      printf("%4zu\t%s\n", cache.entries[i].hits, cache.entries[i].path);
+  }
+
+  fflush(stdout);
+}
+
+void path_cache_print_stats() {
+  printf("entries: %zu\thits: %zu\tmisses: %zu\n",
+         cache.count, cache.hits, cache.misses);
+  fflush(stdout);
+}
+
+void destroy_path_cache() {
+  path_cache_clear();
+  free(cache.entries);
+  cache = (PathCache) { NULL, 0, 0, 0, 0 };
+}
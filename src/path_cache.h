@@ -0,0 +1,21 @@
+#ifndef SRC_PATH_CACHE_H
+#define SRC_PATH_CACHE_H
+
+#include <stdbool.h>
+
+// Resolves a command name through the cached $PATH search. Returns NULL when
+// the command cannot be found.
+const char* path_cache_lookup(const char* cmd);
+
+// Forces a fresh $PATH search for cmd and caches the result
+bool path_cache_insert(const char* cmd);
+
+void path_cache_clear();
+
+void path_cache_print();
+
+void path_cache_print_stats();
+
+void destroy_path_cache();
+
+#endif
@@ -10,6 +10,7 @@
 // Included Files
 #include "quash.h" // Main shell header for structure definitions
 
+#include <errno.h> // For errno when a script cannot be opened
 #include <limits.h> // For PATH_MAX and other limits
 #include <stdbool.h> // For boolean types
 #include <string.h> // For string manipulation functions
@@ -17,9 +18,14 @@
 #include <stdio.h> // For standard I/O operations
 
 #include "command.h" // Header for command structures
+#include "events.h" // Header for the event loop stdin is read through
 #include "execute.h" // Header for execution functions
 #include "parsing_interface.h" // Header for parsing commands
 #include "memory_pool.h" // Header for memory management
+#include "path_cache.h" // Header for the executable lookup cache
+#include "jobs.h" // Header for background job bookkeeping
+#include "trace.h" // Header for QUASH_TRACE event tracing
+#include "var_store.h" // Header for the shell variable table
 
 
 // Private Variables 
@@ -30,14 +36,15 @@ static QuashState state; // This keeps track of the shell's current status
 // Initialize the shell state with defaults
 static QuashState initial_state() {
   return (QuashState) {
-    true
+    true,
     isatty(STDIN_FILENO),  // Check if we're interacting with a terminal
-    NULL   // Placeholder for the command string
+    false, // Commands come from stdin until main sees a script
+    NULL   // No command line parsed yet
   };
 }
 
 // Display a prompt for the user to enter a command
-static void print_prompt() {
+void print_prompt() {
   bool should_free = true;
   char* cwd = get_current_directory(&should_free); // Grab current working directory
   assert(cwd != NULL); // Ensure we successfully got the directory
@@ -57,15 +64,29 @@ static void print_prompt() {
     free(cwd); // Clean up the allocated cwd memory
 }
 
+// Caps the memory the pool keeps between lines at $QUASH_POOL_RETAIN bytes
+static void read_pool_retain_limit() {
+  const char* setting = lookup_env("QUASH_POOL_RETAIN");
+  long limit;
+
+  if (setting == NULL || *setting == '\0')
+    return;
+
+  if (parse_size(setting, &limit))
+    set_memory_pool_retain_limit(limit);
+  else
+    fprintf(stderr, "WARNING: Ignoring invalid QUASH_POOL_RETAIN \"%s\"\n", setting);
+}
+
 //Public Functions
 
 bool is_running() {
   return state.running; 
 }
 
-// Create a copy of the current command string
+// Build the text of the current command line, only needed for background jobs
 char* get_command_string() {
-  return strdup(state.parsed_str); // Duplicate the string for safety
+  return stringify_script(state.parsed_script); // Valid until the pool is reset
 }
 
 // Check if we're reading input from a terminal
@@ -73,6 +94,11 @@ bool is_tty() {
   return state.is_a_tty; // Just return the status
 }
 
+// Check if commands come from a script file or -c
+bool is_batch() {
+  return state.batch;
+}
+
 // Stop the main loop of Quash
 void end_main_loop() {
   state.running = false; 
@@ -85,6 +111,9 @@ void end_main_loop() {
  * greets the user, and enters a loop to handle commands until 
  * the shell is closed.
  *
+ * Quash reads commands from stdin, from a script file given as the first
+ * argument, or from the string following `-c`.
+ *
  * @param argc Number of command line arguments
  * @param argv Array of command line argument strings
  *
@@ -93,6 +122,25 @@ void end_main_loop() {
 int main(int argc, char** argv) {
   state = initial_state(); // Get our shell state ready
 
+  // Scripts and -c commands are never interactive, even on a terminal
+  if (argc > 1) {
+    if (strcmp(argv[1], "-c") == 0) {
+      if (argc < 3) {
+        fprintf(stderr, "Usage: %s [-c command | script]\n", argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      open_script_string(argv[2]); // Lex the command string
+    }
+    else if (!open_script_file(argv[1])) { // Map the script into memory
+      fprintf(stderr, "quash: %s: %s\n", argv[1], strerror(errno));
+      return EXIT_FAILURE;
+    }
+
+    state.is_a_tty = false; // No banner and no prompt
+    state.batch = true;
+  }
+
   // If we're in a terminal, print a welcome message
   if (is_tty()) {
     puts("Welcome to Quash!"); // Friendly greeting
@@ -102,22 +150,39 @@ int main(int argc, char** argv) {
   }
 
   // Set up cleanup actions for when we exit
+  trace_open(); // Start tracing if QUASH_TRACE is set
+  atexit(trace_close); // Registered first so it runs last
   atexit(destroy_parser); // Free the parser resources
   atexit(destroy_memory_pool); // Free the memory pool
+  atexit(destroy_path_cache); // Free the executable lookup cache
+  atexit(destroy_job_table); // Free the background job table
+  atexit(destroy_var_store); // Free the shell variables
+
+  // Wait for stdin in epoll, which also reports background jobs as they finish
+  if (!is_batch()) {
+    events_open(STDIN_FILENO);
+    atexit(events_close);
+  }
+
+  initialize_memory_pool(1024); // Set up the memory pool reused for every command line
+  read_pool_retain_limit(); // How much of it to keep between lines
 
   // Main loop for running commands
   while (is_running()) {
+    check_jobs_bg_status(); // Report jobs that finished since the last line
+
     if (is_tty())
       print_prompt(); // Show the command prompt if in terminal
 
-    initialize_memory_pool(1024); // Set up a fresh memory pool for command parsing
     CommandHolder* script = parse(&state); // Parse the input commands
 
     if (script != NULL)
       run_script(script); // If we got valid commands, execute them
 
-    destroy_memory_pool(); // Clean up the memory pool after execution
+    reset_memory_pool(); // Rewind the memory pool for the next line
   }
 
+  finish_pending_jobs(); // Background jobs still waiting for a slot must not be lost
+
   return EXIT_SUCCESS; // Everything went fine, exit successfully
 }
@@ -10,11 +10,16 @@
 typedef struct QuashState {
   bool running;  
   bool is_a_tty;    
-  char* parsed_str; 
+  bool batch;       // Commands come from a script file or -c
+  CommandHolder* parsed_script; // Last line parsed, stringified on demand
 } QuashState;
 
 bool is_tty();
 
+void print_prompt();
+
+bool is_batch();
+
 char* get_command_string();
 
 bool is_running();
@@ -0,0 +1,155 @@
+/* trace.c
+ *
+ * Opt-in event tracing in the Chrome trace-event JSON format, which Perfetto
+ * and chrome://tracing load directly. Set QUASH_TRACE to a file name to
+ * record parsing, pipeline setup, launches, builtins and waits. Events are
+ * formatted into a local buffer and written with write(2), so a forked
+ * child never flushes a copy of quash's pending events.
+ */
+
+#include "trace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_BUF_SIZE (64 * 1024)
+#define TRACE_EVENT_MAX 1024 // Longest single event, longer details are cut
+
+bool trace_enabled = false;
+
+static int trace_fd = -1;
+static pid_t trace_pid = 0; // Process that owns the trace
+static char trace_buf[TRACE_BUF_SIZE];
+static size_t trace_len = 0;
+static bool trace_first = true; // No comma before the first event
+
+uint64_t __trace_clock_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void __trace_flush() {
+  size_t off = 0;
+
+  while (off < trace_len) {
+    ssize_t n = write(trace_fd, trace_buf + off, trace_len - off);
+
+    if (n <= 0)
+      break;
+
+    off += n;
+  }
+
+  trace_len = 0;
+}
+
+static void __trace_append(const char* str, size_t len) {
+  if (trace_len + len > TRACE_BUF_SIZE)
+    __trace_flush();
+
+  memcpy(trace_buf + trace_len, str, len);
+  trace_len += len;
+}
+
+// Copies str into out as the body of a JSON string
+static size_t __escape(char* out, size_t cap, const char* str) {
+  size_t len = 0;
+
+  for (; *str != '\0' && len + 7 < cap; ++str) {
+    unsigned char c = *str;
+
+    if (c == '"' || c == '\\') {
+      out[len++] = '\\';
+      out[len++] = c;
+    }
+    else if (c < 0x20) {
+      len += snprintf(out + len, cap - len, "\\u%04x", c);
+    }
+    else {
+      out[len++] = c;
+    }
+  }
+
+  out[len] = '\0';
+
+  return len;
+}
+
+static void __trace_event(const char* name, char phase, uint64_t ts_ns,
+                          uint64_t dur_ns, pid_t tid, const char* detail) {
+  char event[TRACE_EVENT_MAX];
+  char escaped[TRACE_EVENT_MAX / 2];
+  char extent[48]; // Duration of a span, scope of an instant
+  int len;
+
+  __escape(escaped, sizeof(escaped), detail != NULL ? detail : "");
+
+  // Timestamps are microseconds, kept to the nanosecond
+  if (phase == 'X')
+    snprintf(extent, sizeof(extent), "\"dur\":%llu.%03llu,",
+             (unsigned long long) (dur_ns / 1000), (unsigned long long) (dur_ns % 1000));
+  else
+    snprintf(extent, sizeof(extent), "\"s\":\"t\",");
+
+  len = snprintf(event, sizeof(event),
+                 "%s{\"name\":\"%s\",\"cat\":\"quash\",\"ph\":\"%c\","
+                 "\"ts\":%llu.%03llu,%s\"pid\":%d,\"tid\":%d,"
+                 "\"args\":{\"detail\":\"%s\"}}",
+                 trace_first ? "\n" : ",\n", name, phase,
+                 (unsigned long long) (ts_ns / 1000), (unsigned long long) (ts_ns % 1000),
+                 extent, (int) trace_pid, (int) (tid != 0 ? tid : trace_pid), escaped);
+
+  if (len < 0)
+    return;
+
+  if ((size_t) len >= sizeof(event))
+    len = sizeof(event) - 1;
+
+  trace_first = false;
+  __trace_append(event, len);
+}
+
+void trace_open() {
+  const char* path = getenv("QUASH_TRACE");
+
+  if (path == NULL || *path == '\0')
+    return;
+
+  trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+  if (trace_fd < 0) {
+    perror("WARNING: Failed to open QUASH_TRACE");
+    return;
+  }
+
+  trace_pid = getpid();
+  trace_enabled = true;
+  __trace_append("[", 1);
+}
+
+void trace_close() {
+  if (!trace_enabled || getpid() != trace_pid)
+    return;
+
+  __trace_append("\n]\n", 3);
+  __trace_flush();
+  close(trace_fd);
+
+  trace_fd = -1;
+  trace_enabled = false;
+}
+
+void __trace_complete(const char* name, uint64_t start_ns, pid_t tid, const char* detail) {
+  __trace_event(name, 'X', start_ns, __trace_clock_ns() - start_ns, tid, detail);
+}
+
+void __trace_instant(const char* name, pid_t tid, const char* detail) {
+  __trace_event(name, 'i', __trace_clock_ns(), 0, tid, detail);
+}
@@ -0,0 +1,43 @@
+#ifndef SRC_TRACE_H
+#define SRC_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// True while events are being written to the file named by $QUASH_TRACE
+extern bool trace_enabled;
+
+// Starts tracing if $QUASH_TRACE names a file that can be created
+void trace_open();
+
+// Finishes the JSON array and closes the trace. Only the process that opened
+// the trace writes anything, so forked children may call it safely.
+void trace_close();
+
+uint64_t __trace_clock_ns();
+
+void __trace_complete(const char* name, uint64_t start_ns, pid_t tid, const char* detail);
+
+void __trace_instant(const char* name, pid_t tid, const char* detail);
+
+// Start time of a span, or 0 without reading the clock when tracing is off
+static inline uint64_t trace_begin() {
+  return trace_enabled ? __trace_clock_ns() : 0;
+}
+
+// Records a span from start_ns until now. tid 0 puts it on quash's own track,
+// a child pid gives the child a track of its own. detail may be NULL.
+static inline void trace_end(const char* name, uint64_t start_ns, pid_t tid,
+                             const char* detail) {
+  if (trace_enabled)
+    __trace_complete(name, start_ns, tid, detail);
+}
+
+// Records a point in time, such as a child being reaped
+static inline void trace_instant(const char* name, pid_t tid, const char* detail) {
+  if (trace_enabled)
+    __trace_instant(name, tid, detail);
+}
+
+#endif
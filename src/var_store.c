@@ -0,0 +1,187 @@
+/* var_store.c
+ *
+ * Shell variables in an open addressed table with linear probing. Each entry
+ * holds its variable as one "NAME=value" string, so the name is stored once
+ * and the same string goes straight into the environment of children. The
+ * envp array handed to exec is only rebuilt after a variable changes.
+ */
+
+#include "var_store.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VAR_STORE_INIT_CAP 128
+
+extern char** environ;
+
+typedef struct VarEntry {
+  char* pair;      // "NAME=value", NULL marks an empty slot
+  size_t name_len; // Length of NAME
+  size_t hash;     // Hash of NAME, kept for probing and growing
+} VarEntry;
+
+typedef struct VarStore {
+  VarEntry* entries;
+  size_t cap;    // Always a power of two
+  size_t count;
+  bool loaded;   // The process environment has been imported
+  char** envp;   // Pointers to every pair, NULL terminated
+  bool dirty;    // envp no longer matches the table
+} VarStore;
+
+static VarStore store = { NULL, 0, 0, false, NULL, true };
+
+// FNV-1a hash of the first len bytes of name
+static size_t __hash_name(const char* name, size_t len) {
+  uint64_t h = 14695981039346656037ULL;
+
+  for (size_t i = 0; i < len; ++i) {
+    h ^= (unsigned char) name[i];
+    h *= 1099511628211ULL;
+  }
+
+  return (size_t) h;
+}
+
+// Find the slot holding name, or the empty slot where it would be inserted
+static VarEntry* __find_slot(VarEntry* entries, size_t cap, const char* name,
+                             size_t len, size_t hash) {
+  size_t mask = cap - 1;
+  size_t i = hash & mask;
+
+  while (entries[i].pair != NULL &&
+         (entries[i].hash != hash || entries[i].name_len != len ||
+          memcmp(entries[i].pair, name, len) != 0))
+    i = (i + 1) & mask;
+
+  return &entries[i];
+}
+
+static void __grow(size_t new_cap) {
+  VarEntry* entries = calloc(new_cap, sizeof(VarEntry));
+
+  if (entries == NULL) {
+    fprintf(stderr, "ERROR: Failed to allocate the variable store\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < store.cap; ++i) {
+    VarEntry* entry = &store.entries[i];
+
+    if (entry->pair != NULL)
+      *__find_slot(entries, new_cap, entry->pair, entry->name_len, entry->hash) = *entry;
+  }
+
+  free(store.entries);
+  store.entries = entries;
+  store.cap = new_cap;
+}
+
+// Stores pair, which must be a malloc'd "NAME=value" with name_len bytes of
+// NAME. The table takes ownership of pair.
+static void __insert_pair(char* pair, size_t name_len) {
+  // Keep the load factor at or below one half
+  if (2 * (store.count + 1) > store.cap)
+    __grow(store.cap == 0 ? VAR_STORE_INIT_CAP : 2 * store.cap);
+
+  size_t hash = __hash_name(pair, name_len);
+  VarEntry* entry = __find_slot(store.entries, store.cap, pair, name_len, hash);
+
+  if (entry->pair == NULL)
+    ++store.count;
+  else
+    free(entry->pair);
+
+  *entry = (VarEntry) { pair, name_len, hash };
+  store.dirty = true;
+}
+
+static void __load_environ() {
+  store.loaded = true;
+
+  for (char** env = environ; *env != NULL; ++env) {
+    const char* eq = strchr(*env, '=');
+
+    if (eq != NULL && eq != *env)
+      __insert_pair(strdup(*env), eq - *env);
+  }
+}
+
+const char* var_store_get_n(const char* name, size_t len) {
+  if (!store.loaded)
+    __load_environ();
+
+  if (store.count == 0)
+    return NULL;
+
+  VarEntry* entry = __find_slot(store.entries, store.cap, name, len,
+                                __hash_name(name, len));
+
+  return entry->pair == NULL ? NULL : entry->pair + len + 1;
+}
+
+const char* var_store_get(const char* name) {
+  return var_store_get_n(name, strlen(name));
+}
+
+void var_store_set(const char* name, const char* value) {
+  if (!store.loaded)
+    __load_environ();
+
+  size_t name_len = strlen(name);
+  size_t value_len = strlen(value);
+  char* pair = malloc(name_len + value_len + 2);
+
+  if (pair == NULL) {
+    fprintf(stderr, "ERROR: Failed to allocate a variable\n");
+    exit(EXIT_FAILURE);
+  }
+
+  memcpy(pair, name, name_len);
+  pair[name_len] = '=';
+  memcpy(pair + name_len + 1, value, value_len + 1);
+
+  __insert_pair(pair, name_len);
+}
+
+char** var_store_envp() {
+  if (!store.loaded)
+    __load_environ();
+
+  if (!store.dirty)
+    return store.envp;
+
+  char** envp = realloc(store.envp, (store.count + 1) * sizeof(char*));
+
+  if (envp == NULL) {
+    fprintf(stderr, "ERROR: Failed to allocate the environment\n");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t n = 0;
+
+  for (size_t i = 0; i < store.cap; ++i) {
+    if (store.entries[i].pair != NULL)
+      envp[n++] = store.entries[i].pair;
+  }
+
+  envp[n] = NULL;
+
+  store.envp = envp;
+  store.dirty = false;
+
+  return envp;
+}
+
+void destroy_var_store() {
+  for (size_t i = 0; i < store.cap; ++i)
+    free(store.entries[i].pair);
+
+  free(store.entries);
+  free(store.envp);
+  store = (VarStore) { NULL, 0, 0, false, NULL, true };
+}
@@ -0,0 +1,21 @@
+#ifndef SRC_VAR_STORE_H
+#define SRC_VAR_STORE_H
+
+#include <stddef.h>
+
+// Returns the value of a shell variable, or NULL if it is not set. The
+// process environment is imported the first time the store is used.
+const char* var_store_get(const char* name);
+
+// Same as var_store_get for a name that is not NUL terminated
+const char* var_store_get_n(const char* name, size_t len);
+
+void var_store_set(const char* name, const char* value);
+
+// Environment for children as "NAME=value" strings. The array is rebuilt only
+// after a variable has changed and stays valid until the next change.
+char** var_store_envp();
+
+void destroy_var_store();
+
+#endif